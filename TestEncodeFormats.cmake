@@ -0,0 +1,52 @@
+#[==[
+ctest script: renders a short test clip with ffmpeg_ntsc in encoder pixel formats other than YUV444P and checks
+that the luma matches a YUV444P render of the same clip. (composite_layer() always draws YUV444P, and the encode
+stage converts to the codec's format. a render that drew nothing, or the wrong planes, comes out far below the
+limit.) the clip is made, and the renders compared, with the ffmpeg command line tool.
+
+  cmake -DNTSC=<ffmpeg_ntsc> -DFFMPEG=<ffmpeg> -DWORK=<scratch dir> -P TestEncodeFormats.cmake
+#]==]
+
+set(MIN_PSNR_Y 40)
+
+file(MAKE_DIRECTORY ${WORK})
+
+execute_process(
+	COMMAND ${FFMPEG} -y -v error
+		-f lavfi -i testsrc2=size=720x480:rate=30000/1001:duration=1
+		-f lavfi -i sine=frequency=1000:sample_rate=48000:duration=1
+		-c:v ffv1 -pix_fmt yuv444p -c:a pcm_s16le ${WORK}/source.mkv
+	RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+	message(FATAL_ERROR "Failed to make the test clip")
+endif ()
+
+# render ${WORK}/${name}.mkv with the given ffmpeg_ntsc options
+function(render name)
+	execute_process(COMMAND ${NTSC} -i ${WORK}/source.mkv ${ARGN} -o ${WORK}/${name}.mkv
+		RESULT_VARIABLE rc OUTPUT_QUIET ERROR_VARIABLE err)
+	if (NOT rc EQUAL 0)
+		message(FATAL_ERROR "ffmpeg_ntsc ${ARGN} failed:\n${err}")
+	endif ()
+endfunction()
+
+render(yuv444p)
+
+foreach (test "yuv420p;-pix-fmt;yuv420p" "intermediate;-encoder-preset;intermediate")
+	list(GET test 0 name)
+	list(SUBLIST test 1 -1 options)
+	render(${name} ${options})
+
+	execute_process(
+		COMMAND ${FFMPEG} -v info -i ${WORK}/${name}.mkv -i ${WORK}/yuv444p.mkv
+			-lavfi "[0:v]format=yuv444p[a];[1:v]format=yuv444p[b];[a][b]psnr" -f null -
+		RESULT_VARIABLE rc OUTPUT_QUIET ERROR_VARIABLE err)
+	if (NOT rc EQUAL 0 OR NOT err MATCHES "PSNR y:([0-9.]+|inf)")
+		message(FATAL_ERROR "Failed to compare the ${name} render:\n${err}")
+	endif ()
+	set(psnr ${CMAKE_MATCH_1})
+	message(STATUS "${name}: luma PSNR ${psnr} dB against yuv444p")
+	if (NOT psnr STREQUAL "inf" AND psnr LESS MIN_PSNR_Y)
+		message(FATAL_ERROR "${name} render does not match the yuv444p one (luma PSNR ${psnr} dB)")
+	endif ()
+endforeach ()
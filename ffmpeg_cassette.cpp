@@ -573,13 +573,17 @@ int		  audio_dst_data_alloc_samples = 0;
 int		  audio_dst_data_linesize	  = 0;
 int		  audio_dst_data_samples	   = 0;
 
-bool do_audio_decode_and_render(AVPacket& pkt, unsigned long long& audio_sample) {
-	int got_frame = 0;
+// send a packet to the audio decoder (NULL at the end, to drain it) and render every frame it has ready
+void do_audio_decode_and_render(AVPacket* pkt, unsigned long long& audio_sample) {
+	if (avcodec_send_packet(input_avstream_audio_codec_context, pkt) < 0) {
+		fprintf(stderr, "No audio decoded\n");
+		return;
+	}
 
-	if (avcodec_decode_audio4(input_avstream_audio_codec_context, input_avstream_audio_frame, &got_frame, &pkt) >= 0) {
-		if (got_frame != 0 && input_avstream_audio_frame->nb_samples != 0) {
+	while (avcodec_receive_frame(input_avstream_audio_codec_context, input_avstream_audio_frame) >= 0) {
+		if (input_avstream_audio_frame->nb_samples != 0) {
 			unsigned long long tgt_sample = input_avstream_audio_frame->pts;
-			if (tgt_sample == AV_NOPTS_VALUE) tgt_sample = pkt.pts;
+			if (tgt_sample == AV_NOPTS_VALUE) tgt_sample = input_avstream_audio_frame->pkt_pts;
 
 			if (tgt_sample == AV_NOPTS_VALUE)
 				tgt_sample = audio_sample;  // don't want me to guess? give me PTS timestamps then!
@@ -621,7 +625,7 @@ bool do_audio_decode_and_render(AVPacket& pkt, unsigned long long& audio_sample)
 				if (swr_init(input_avstream_audio_resampler) < 0) {
 					fprintf(stderr, "Failed to init audio resampler\n");
 					swr_free(&input_avstream_audio_resampler);
-					return got_frame;
+					continue;
 				}
 				input_avstream_audio_resampler_rate		= input_avstream_audio_codec_context->sample_rate;
 				input_avstream_audio_resampler_channels = input_avstream_audio_codec_context->channels;
@@ -718,11 +722,7 @@ bool do_audio_decode_and_render(AVPacket& pkt, unsigned long long& audio_sample)
 				}
 			}
 		}
-	} else {
-		fprintf(stderr, "No audio decoded\n");
 	}
-
-	return (got_frame != 0);
 }
 
 int main(int argc, char** argv) {
@@ -871,7 +871,6 @@ int main(int argc, char** argv) {
 		unsigned long long audio_sample		= 0;
 		unsigned long long video_field		= 0;
 		double			   adj_time			= 0;
-		int				   got_frame		= 0;
 		double			   t, pt = -1;
 		AVPacket		   pkt;
 
@@ -926,7 +925,7 @@ int main(int argc, char** argv) {
 
 			if (input_avstream_audio != NULL && pkt.stream_index == input_avstream_audio->index) {
 				av_packet_rescale_ts(&pkt, input_avstream_audio->time_base, output_avstream_audio->time_base);
-				do_audio_decode_and_render(/*&*/ pkt, /*&*/ audio_sample);
+				do_audio_decode_and_render(&pkt, /*&*/ audio_sample);
 			}
 
 			av_packet_unref(&pkt);
@@ -936,18 +935,9 @@ int main(int argc, char** argv) {
 		av_packet_unref(&pkt);
 		av_init_packet(&pkt);
 
-		/* the encoder usually has a delay.
-		 * we need the encoder to flush those frames out. */
-		{
-			do {
-				if (DIE != 0) break;
-
-				pkt.size = 0;
-				pkt.data = NULL;
-				if (input_avstream_audio != NULL)
-					got_frame |= do_audio_decode_and_render(/*&*/ pkt, /*&*/ audio_sample) ? 1 : 0;
-			} while (got_frame);
-		}
+		/* the decoder usually has a delay.
+		 * we need the decoder to flush those frames out. */
+		if (input_avstream_audio != NULL && DIE == 0) do_audio_decode_and_render(NULL, /*&*/ audio_sample);
 
 		if (audio_dst_data != NULL) {
 			av_freep(&audio_dst_data[0]);  // NTS: Why??
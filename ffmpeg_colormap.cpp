@@ -137,6 +137,7 @@ public:
 						ac++;
 					} else if (isctx->codec_type == AVMEDIA_TYPE_VIDEO) {
 						if (input_avstream_video == NULL && vc == 0) {
+							isctx->thread_count = 0;  // one decoder thread per CPU
 							if (avcodec_open2(isctx, avcodec_find_decoder(isctx->codec_id), NULL) >= 0) {
 								input_avstream_video			   = is;
 								input_avstream_video_codec_context = isctx;
@@ -223,11 +224,19 @@ public:
 		if (eof) return false;
 		if (input_avfmt == NULL) return false;
 
+		/* frames the decoders still hold from packets already sent come first, one per call */
+		if (receive_audio() || receive_video()) return true;
+
 		do {
 			if (eof_stream) break;
 			avpkt_release();
 			avpkt_init();
 			if (av_read_frame(input_avfmt, &avpkt) < 0) {
+				/* drain the decoders. what they held comes out of receive_audio()/receive_video() above */
+				if (input_avstream_audio_codec_context != NULL)
+					avcodec_send_packet(input_avstream_audio_codec_context, NULL);
+				if (input_avstream_video_codec_context != NULL)
+					avcodec_send_packet(input_avstream_video_codec_context, NULL);
 				eof_stream = true;
 				return false;
 			}
@@ -270,8 +279,7 @@ public:
 			if (input_avstream_audio != NULL && avpkt.stream_index == input_avstream_audio->index) {
 				if (got_audio) fprintf(stderr, "Audio content lost\n");
 				av_packet_rescale_ts(&avpkt, input_avstream_audio->time_base, output_avstream_audio->time_base);
-				handle_audio(/*&*/ avpkt);
-				got_audio = true;
+				handle_audio(/*&*/ avpkt);  // will set got_audio
 				break;
 			} else if (input_avstream_video != NULL && avpkt.stream_index == input_avstream_video->index) {
 				if (got_video) fprintf(stderr, "Video content lost\n");
@@ -286,24 +294,23 @@ public:
 
 		if (eof_stream) {
 			avpkt_release();
-			avpkt.size = 0;
-			avpkt.data = NULL;
-			handle_frame(/*&*/ avpkt);  // will set got_video
-			if (!got_video)
-				eof = true;
-			else
-				fprintf(stderr, "Got latent frame\n");
+			eof = true;  // drained
 		}
 
 		return true;
 	}
 	void handle_audio(AVPacket& pkt) {
-		int got_frame = 0;
+		if (avcodec_send_packet(input_avstream_audio_codec_context, &pkt) < 0) fprintf(stderr, "No audio decoded\n");
+		receive_audio();  // will set got_audio
+	}
+	// the next frame the audio decoder has ready, resampled into audio_dst_data. sets got_audio
+	bool receive_audio(void) {
+		if (input_avstream_audio_codec_context == NULL) return false;
 
-		if (avcodec_decode_audio4(input_avstream_audio_codec_context, input_avstream_audio_frame, &got_frame, &pkt) >=
-			0) {
-			if (got_frame != 0 && input_avstream_audio_frame->nb_samples != 0) {
-				if (input_avstream_audio_frame->pts == AV_NOPTS_VALUE) input_avstream_audio_frame->pts = pkt.pts;
+		if (avcodec_receive_frame(input_avstream_audio_codec_context, input_avstream_audio_frame) >= 0) {
+			if (input_avstream_audio_frame->nb_samples != 0) {
+				if (input_avstream_audio_frame->pts == AV_NOPTS_VALUE)
+					input_avstream_audio_frame->pts = input_avstream_audio_frame->pkt_pts;
 
 				if (input_avstream_audio_resampler != NULL) {
 					if (input_avstream_audio_resampler_rate != input_avstream_audio_codec_context->sample_rate ||
@@ -334,7 +341,7 @@ public:
 					if (swr_init(input_avstream_audio_resampler) < 0) {
 						fprintf(stderr, "Failed to init audio resampler\n");
 						swr_free(&input_avstream_audio_resampler);
-						return;
+						return false;
 					}
 					input_avstream_audio_resampler_rate		= input_avstream_audio_codec_context->sample_rate;
 					input_avstream_audio_resampler_channels = input_avstream_audio_codec_context->channels;
@@ -385,8 +392,10 @@ public:
 					audio_dst_data_out_audio_sample = audio_sample;
 					audio_sample += audio_dst_data_out_samples;
 				}
+				got_audio = true;
 			}
 		}
+		return got_audio;
 	}
 	void frame_copy_scale(void) {
 		if (input_avstream_video_frame_rgb == NULL) {
@@ -456,16 +465,17 @@ public:
 		}
 	}
 	void handle_frame(AVPacket& pkt) {
-		int got_frame = 0;
+		if (avcodec_send_packet(input_avstream_video_codec_context, &pkt) < 0) fprintf(stderr, "No video decoded\n");
+		receive_video();  // will set got_video
+	}
+	// the next frame the video decoder has ready. sets got_video
+	bool receive_video(void) {
+		if (input_avstream_video_codec_context == NULL) return false;
 
-		if (avcodec_decode_video2(input_avstream_video_codec_context, input_avstream_video_frame, &got_frame, &pkt) >=
-			0) {
-			if (got_frame != 0 && input_avstream_video_frame->width > 0 && input_avstream_video_frame->height > 0) {
-				got_video = true;
-			}
-		} else {
-			fprintf(stderr, "No video decoded\n");
+		if (avcodec_receive_frame(input_avstream_video_codec_context, input_avstream_video_frame) >= 0) {
+			if (input_avstream_video_frame->width > 0 && input_avstream_video_frame->height > 0) got_video = true;
 		}
+		return got_video;
 	}
 	void avpkt_init(void) {
 		if (!avpkt_valid) {
@@ -735,23 +745,36 @@ void write_out_audio(InputFile& fin) {
 	fin.audio_sample = fin.last_written_sample = fin.audio_dst_data_out_audio_sample + fin.audio_dst_data_out_samples;
 }
 
-void output_frame(AVFrame* frame, unsigned long long field_number) {
-	int		 gotit = 0;
-	AVPacket pkt;
+// send a frame to the video encoder (NULL at the end, to drain it) and write out the packets it has ready.
+// one packet does for all of them: av_interleaved_write_frame() takes what it holds and leaves it blank
+void encode_video(AVFrame* frame) {
+	static AVPacket* pkt = NULL;
 
-	av_init_packet(&pkt);
-	if (av_new_packet(&pkt, 50000000 / 8) < 0) {
+	if (pkt == NULL && (pkt = av_packet_alloc()) == NULL) {
 		fprintf(stderr, "Failed to alloc vid packet\n");
 		return;
 	}
 
+	if (avcodec_send_frame(output_avstream_video_codec_context, frame) >= 0) {
+		while (avcodec_receive_packet(output_avstream_video_codec_context, pkt) >= 0) {
+			pkt->stream_index = output_avstream_video->index;
+			av_packet_rescale_ts(pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
+
+			if (av_interleaved_write_frame(output_avfmt, pkt) < 0) fprintf(stderr, "AV write frame failed video\n");
+		}
+	} else {
+		fprintf(stderr, "Failed to encode video\n");
+	}
+
+	if (frame == NULL) av_packet_free(&pkt);
+}
+
+void output_frame(AVFrame* frame, unsigned long long field_number) {
 	frame->key_frame = (field_number % (15ULL * 2ULL)) == 0 ? 1 : 0;
 
 	{
 		frame->interlaced_frame = 0;
 		frame->pts				= field_number;
-		pkt.pts					= field_number;
-		pkt.dts					= field_number;
 	}
 
 	fprintf(stderr,
@@ -759,17 +782,7 @@ void output_frame(AVFrame* frame, unsigned long long field_number) {
 		"Output field %llu ",
 		field_number);
 	fflush(stderr);
-	if (avcodec_encode_video2(output_avstream_video_codec_context, &pkt, frame, &gotit) == 0) {
-		if (gotit) {
-			pkt.stream_index = output_avstream_video->index;
-			av_packet_rescale_ts(
-				&pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
-
-			if (av_interleaved_write_frame(output_avfmt, &pkt) < 0) fprintf(stderr, "AV write frame failed video\n");
-		}
-	}
-
-	av_packet_unref(&pkt);
+	encode_video(frame);
 }
 
 void take_colormap(AVFrame* srcframe, InputFile& inputfile) {
@@ -1079,27 +1092,7 @@ int main(int argc, char** argv) {
 	}
 
 	/* flush encoder delay */
-	do {
-		AVPacket pkt;
-		int		 gotit = 0;
-
-		av_init_packet(&pkt);
-		if (av_new_packet(&pkt, 50000000 / 8) < 0) break;
-
-		if (avcodec_encode_video2(output_avstream_video_codec_context, &pkt, NULL, &gotit) == 0) {
-			if (gotit) {
-				pkt.stream_index = output_avstream_video->index;
-				av_packet_rescale_ts(
-					&pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
-
-				if (av_interleaved_write_frame(output_avfmt, &pkt) < 0)
-					fprintf(stderr, "AV write frame failed video\n");
-			}
-		}
-
-		av_packet_unref(&pkt);
-		if (!gotit) break;
-	} while (1);
+	encode_video(NULL);
 
 	/* close output */
 	if (output_avstream_video_resampler != NULL) {
@@ -1,14 +1,23 @@
 #include <cassert>
+#include <climits>
 #include <fcntl.h>
 #include <cmath>
 #include <csignal>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <sys/mman.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 extern "C"
 {
 #include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
 #include <libavcodec/avcodec.h>
@@ -22,12 +31,79 @@ using namespace std;
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+using Color = std::tuple<uint8_t, uint8_t, uint8_t>;
+
+// bounded single producer / single consumer ring between two threads of the render pipeline.
+// lock-free: head is only written by the consumer and tail only by the producer. a side that finds the ring
+// empty (or full) spins briefly, then yields, then naps, so a stage waiting on a slow neighbour costs little CPU.
+template <typename T>
+class SPSCRing
+{
+public:
+	explicit SPSCRing(const size_t depth) : slots(depth + 1) {}
+	SPSCRing(const SPSCRing&) = delete;
+	SPSCRing& operator=(const SPSCRing&) = delete;
+
+	void push(const T& v) {
+		const size_t t	 = tail.load(std::memory_order_relaxed);
+		const size_t nt	= (t + 1) % slots.size();
+		unsigned int spins = 0;
+
+		while (nt == head.load(std::memory_order_acquire)) { backoff(spins); }
+		slots[t] = v;
+		tail.store(nt, std::memory_order_release);
+	}
+	bool try_pop(T& v) {
+		const size_t h = head.load(std::memory_order_relaxed);
+
+		if (h == tail.load(std::memory_order_acquire)) { return false; }
+		v = slots[h];
+		head.store((h + 1) % slots.size(), std::memory_order_release);
+		return true;
+	}
+	// blocks until there is something to pop. false once the producer closed the ring and it ran empty.
+	bool pop(T& v) {
+		unsigned int spins = 0;
 
-#include <boost/fiber/unbuffered_channel.hpp>
+		while (!try_pop(v)) {
+			if (done()) { return try_pop(v); }
+			backoff(spins);
+		}
+		return true;
+	}
+	void close() { closed.store(true, std::memory_order_release); }
+	bool done() const {
+		return closed.load(std::memory_order_acquire) &&
+			   head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+	}
+
+	static void backoff(unsigned int& spins) {
+		if (spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+			_mm_pause();
+#endif
+		} else if (spins < 1024) {
+			std::this_thread::yield();
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		spins++;
+	}
 
-using Color			= std::tuple<uint8_t, uint8_t, uint8_t>;
-using channel_t		= boost::fibers::unbuffered_channel<tuple<AVFrame*, unsigned long long int>>;
-auto EncoderChannel = new channel_t();
+private:
+	std::vector<T>					slots;
+	alignas(64) std::atomic<size_t> head{0};
+	alignas(64) std::atomic<size_t> tail{0};
+	std::atomic<bool>				closed{false};
+};
 
 /* return a floating point value specifying what to scale the sample
  * value by to reduce it from full volume to dB decibels */
@@ -182,8 +258,10 @@ AVRational output_field_rate				 = {60000, 1001};  // NTSC 60Hz default
 AVRational output_aspect_ratio				 = {4, 3};
 int		   output_width						 = 720;
 int		   output_height					 = 480;
+int		   signal_width						 = 0;      // -signal-width (0 = composite at output_width)
 bool	   output_ntsc						 = true;   // NTSC color subcarrier emulation
 bool	   output_pal						 = false;  // PAL color subcarrier emulation
+bool	   output_video_as_interlaced		 = false;  // -vi: weave the fields into frames at half the field rate
 int		   output_audio_channels			 = 2;	  // VHS stereo (set to 1 for mono)
 int		   output_audio_rate				 = 44100;  // VHS Hi-Fi goes up to 20KHz
 int		   video_scanline_phase_shift		 = 180;
@@ -192,16 +270,226 @@ int		   video_scanline_phase_shift_offset = 0;
 #define RGBTRIPLET(r, g, b)                                                                                            \
 	(((uint32_t)(r) << (uint32_t)16) + ((uint32_t)(g) << (uint32_t)8) + ((uint32_t)(b) << (uint32_t)0))
 
+// samples per scanline composite_layer() works at. with -signal-width the sources are scaled to that instead of
+// the output width, and the finished scanlines back up to the output width (see SignalScale). never more samples
+// than the output has: the scanlines are scaled up in place.
+int composite_width() {
+	return (signal_width > 0 && signal_width < output_width) ? signal_width : output_width;
+}
+
+// video frames whose planes come from an AVBufferPool, one pool per plane.
+// a buffer goes back to its pool when the last reference to it is dropped, which for a frame handed to a frame
+// threaded encoder (or to another pipeline stage) is whenever that is done with it, not when we are.
+class VideoFramePool
+{
+public:
+	bool init(const AVPixelFormat fmt, const int w, const int h) {
+		uint8_t* data[4] = {nullptr, nullptr, nullptr, nullptr};
+		int		 total;
+
+		uninit();
+		if (av_image_fill_linesizes(linesize, fmt, FFALIGN(w, 64)) < 0) { return false; }
+		for (auto& ls : linesize) { ls = FFALIGN(ls, 64); }
+
+		// lay the planes out from a null base to get at their sizes
+		if ((total = av_image_fill_pointers(data, fmt, h, nullptr, linesize)) < 0) { return false; }
+		for (int p = 0; p < 4 && linesize[p] != 0; p++) {
+			const int size = ((p + 1) < 4 && data[p + 1] != nullptr ? static_cast<int>(data[p + 1] - data[p])
+																	 : total - static_cast<int>(data[p] - data[0]));
+
+			pool[p] = av_buffer_pool_init(size + 16 + 64 - 1, av_buffer_allocz);
+			if (pool[p] == nullptr) { return false; }
+		}
+
+		format = fmt;
+		width  = w;
+		height = h;
+		return true;
+	}
+	bool ready() const { return pool[0] != nullptr; }
+	void uninit() {
+		// the pools free themselves once the last outstanding buffer comes back
+		for (auto& p : pool) {
+			if (p != nullptr) { av_buffer_pool_uninit(&p); }
+		}
+	}
+	// give an empty (unref'd) frame a set of planes from the pool
+	bool get(AVFrame* f) {
+		if (!ready()) { return false; }
+		f->format = format;
+		f->width  = width;
+		f->height = height;
+		for (int p = 0; p < 4 && pool[p] != nullptr; p++) {
+			f->buf[p] = av_buffer_pool_get(pool[p]);
+			if (f->buf[p] == nullptr) {
+				av_frame_unref(f);
+				return false;
+			}
+			f->data[p]	 = f->buf[p]->data;
+			f->linesize[p] = linesize[p];
+		}
+		return true;
+	}
+
+private:
+	AVBufferPool* pool[4]	 = {nullptr, nullptr, nullptr, nullptr};
+	int			  linesize[4] = {0, 0, 0, 0};
+	AVPixelFormat format	  = AV_PIX_FMT_NONE;
+	int			  width		  = 0;
+	int			  height	  = 0;
+};
+
 AVFormatContext*	  output_avfmt						  = nullptr;
 AVStream*			  output_avstream_audio				  = nullptr;  // do not free
 AVCodecContext*		  output_avstream_audio_codec_context = nullptr;  // do not free
 AVStream*			  output_avstream_video				  = nullptr;  // do not free
 AVCodecContext*		  output_avstream_video_codec_context = nullptr;  // do not free
-std::vector<AVFrame*> output_avstream_video_frame;					  // ARGB
-AVFrame*			  output_avstream_video_encode_frame = nullptr;   // 4:2:2 or 4:2:0
+std::vector<AVFrame*> output_avstream_video_frame;					  // YUV444P, composite render targets
+std::vector<AVFrame*> output_avstream_video_encode_pool;			  // YUV444P, composite -> encode
+VideoFramePool		  output_avstream_video_encode_buffers;			  // planes of the above
 size_t				  output_avstream_video_frame_delay  = 1;
 size_t				  output_avstream_video_frame_index  = 0;
-struct SwsContext*	output_avstream_video_resampler	= nullptr;
+
+// the video encoder and how it is set up. -encoder-preset fills in all of it from encoder_presets, and the
+// options after it (-vcodec, -crf, ...) change single fields.
+class EncoderSettings
+{
+public:
+	std::string codec{"libx264"};	   // FFmpeg encoder name
+	std::string pix_fmt;				  // empty: YUV444P, what composite_layer() writes, if the codec takes it
+	int			crf{0};				   // < 0: codec default
+	int64_t		bitrate{0};			   // bits/second, 0: codec default. overrides crf
+	std::string preset{"ultrafast"};	// codec speed preset (x264 and friends), empty: codec default
+	std::string tune{"zerolatency"};	// x264 tuning, empty: none. zerolatency rules out frame threads
+	std::string options;				  // more codec options, key=value:key=value
+	int			threads{0};			   // 0: one per CPU
+	int			thread_type{0};		   // FF_THREAD_FRAME and/or FF_THREAD_SLICE, 0: codec default
+};
+
+EncoderSettings output_video_encoder;
+
+class EncoderPreset
+{
+public:
+	const char*		name;
+	EncoderSettings settings;
+};
+
+const EncoderPreset encoder_presets[] = {
+	// lossless, for keeping. FFV1 version 3 codes slices in parallel and checks each one with a CRC
+	{"archive", {"ffv1", "", -1, 0, "", "", "level=3:slices=24:slicecrc=1", 0, 0}},
+	// for editing: ProRes 422 HQ, 10 bit
+	{"intermediate", {"prores_ks", "yuv422p10le", -1, 0, "", "", "profile=hq", 0, 0}},
+	// final files: H.264 4:2:0, which everything plays
+	{"delivery", {"libx264", "yuv420p", 18, 0, "medium", "", "", 0, 0}},
+};
+
+// the codec frame in a format other than YUV444P. with -vi, the fields are converted one at a time so that 4:2:0
+// chroma is not averaged across fields.
+class EncodeConvert
+{
+public:
+	bool init(const AVPixelFormat fmt, const int w, const int h) {
+		const int fh = output_video_as_interlaced ? h / 2 : h;
+
+		uninit();
+		if (fmt == AV_PIX_FMT_YUV444P) { return true; }
+		if ((frame = av_frame_alloc()) == nullptr) { return false; }
+		if (!buffers.init(fmt, w, h)) { return false; }
+		sws = sws_getContext(w, fh, AV_PIX_FMT_YUV444P, w, fh, fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+		return sws != nullptr;
+	}
+	void uninit() {
+		if (sws != nullptr) { sws_freeContext(sws); }
+		sws = nullptr;
+		av_frame_free(&frame);
+		buffers.uninit();
+	}
+	bool active() const { return sws != nullptr; }
+	// src converted, in a frame of our own that stays valid until the next call. nullptr on failure
+	AVFrame* convert(const AVFrame* src) {
+		const unsigned int fields = output_video_as_interlaced ? 2 : 1;
+
+		av_frame_unref(frame);
+		if (!buffers.get(frame)) { return nullptr; }
+		av_frame_copy_props(frame, src);
+		for (unsigned int f = 0; f < fields; f++) {
+			const uint8_t* s[4] = {nullptr, nullptr, nullptr, nullptr};
+			uint8_t*	   d[4] = {nullptr, nullptr, nullptr, nullptr};
+			int			   sl[4] = {0, 0, 0, 0};
+			int			   dl[4] = {0, 0, 0, 0};
+
+			for (unsigned int p = 0; p < 4; p++) {
+				if (src->data[p] != nullptr) {
+					s[p]  = src->data[p] + (src->linesize[p] * f);
+					sl[p] = src->linesize[p] * fields;
+				}
+				if (frame->data[p] != nullptr) {
+					d[p]  = frame->data[p] + (frame->linesize[p] * f);
+					dl[p] = frame->linesize[p] * fields;
+				}
+			}
+			sws_scale(sws, s, sl, 0, src->height / fields, d, dl);
+		}
+		return frame;
+	}
+
+private:
+	SwsContext*	sws{nullptr};
+	AVFrame*	   frame{nullptr};
+	VideoFramePool buffers;
+};
+
+EncodeConvert output_avstream_video_encode_convert;  // encode stage only
+
+// the format to encode in: -pix-fmt, else YUV444P if the codec takes it, else the closest one it does
+AVPixelFormat encoder_pix_fmt(const AVCodec* codec) {
+	AVPixelFormat want = AV_PIX_FMT_YUV444P;
+
+	if (!output_video_encoder.pix_fmt.empty()) {
+		want = av_get_pix_fmt(output_video_encoder.pix_fmt.c_str());
+		if (want == AV_PIX_FMT_NONE) {
+			fprintf(stderr, "Unknown pixel format '%s'\n", output_video_encoder.pix_fmt.c_str());
+			return AV_PIX_FMT_NONE;
+		}
+	}
+	if (codec->pix_fmts == nullptr) { return want; }  // anything goes (rawvideo)
+	for (const AVPixelFormat* f = codec->pix_fmts; *f != AV_PIX_FMT_NONE; f++) {
+		if (*f == want) { return want; }
+	}
+	if (!output_video_encoder.pix_fmt.empty()) {
+		fprintf(stderr, "%s does not take %s\n", codec->name, output_video_encoder.pix_fmt.c_str());
+		return AV_PIX_FMT_NONE;
+	}
+	return avcodec_find_best_pix_fmt_of_list(codec->pix_fmts, AV_PIX_FMT_YUV444P, 0, nullptr);
+}
+
+// decoded formats composite_layer() reads as they are (see YCbCr_to_YIQ_field_row()). a frame of one of these
+// at the output size skips the scale stage. everything else is converted to BGRA at the output size there.
+// hshift/vshift: chroma subsampling, log2. full_range: JPEG range (0...255) rather than 16...235.
+bool ycbcr_source_format(const AVFrame* f, unsigned int& hshift, unsigned int& vshift, bool& full_range) {
+	switch (f->format) {
+		case AV_PIX_FMT_YUV420P:
+		case AV_PIX_FMT_YUVJ420P:
+			hshift = vshift = 1;
+			break;
+		case AV_PIX_FMT_YUV422P:
+		case AV_PIX_FMT_YUVJ422P:
+			hshift = 1;
+			vshift = 0;
+			break;
+		case AV_PIX_FMT_YUV444P:
+		case AV_PIX_FMT_YUVJ444P:
+			hshift = vshift = 0;
+			break;
+		default:
+			return false;
+	}
+
+	full_range = (f->format == AV_PIX_FMT_YUVJ420P || f->format == AV_PIX_FMT_YUVJ422P ||
+				  f->format == AV_PIX_FMT_YUVJ444P || av_frame_get_color_range(f) == AVCOL_RANGE_JPEG);
+	return true;
+}
 
 class InputFile
 {
@@ -216,6 +504,7 @@ public:
 		input_avstream_video			   = nullptr;
 		input_avstream_video_frame		   = nullptr;
 		input_avstream_video_frame_rgb	 = nullptr;
+		input_avstream_video_frame_queued  = nullptr;
 		input_avstream_video_resampler	 = nullptr;
 		input_avstream_video_codec_context = nullptr;
 		next_pts = next_dts = -1LL;
@@ -271,6 +560,7 @@ public:
 						ac++;
 					} else if (isctx->codec_type == AVMEDIA_TYPE_VIDEO) {
 						if (input_avstream_video == nullptr && vc == 0) {
+							isctx->thread_count = 0;  // one decoder thread per CPU
 							if (avcodec_open2(isctx, avcodec_find_decoder(isctx->codec_id), nullptr) >= 0) {
 								input_avstream_video			   = is;
 								input_avstream_video_codec_context = isctx;
@@ -327,7 +617,7 @@ public:
 
 			input_avstream_video_frame_rgb->format = AV_PIX_FMT_BGRA;
 			input_avstream_video_frame_rgb->height = output_height;
-			input_avstream_video_frame_rgb->width  = output_width;
+			input_avstream_video_frame_rgb->width  = composite_width();
 			if (av_frame_get_buffer(input_avstream_video_frame_rgb, 64) < 0) {
 				fprintf(stderr, "Failed to alloc render frame\n");
 				close_input();
@@ -364,11 +654,21 @@ public:
 		if (eof) { return false; }
 		if (input_avfmt == nullptr) { return false; }
 
+		/* frames the decoders still hold from packets already sent come first, one per call */
+		if (receive_audio() || receive_video()) { return true; }
+
 		do {
 			if (eof_stream) { break; }
 			avpkt_release();
 			avpkt_init();
 			if (av_read_frame(input_avfmt, &avpkt) < 0) {
+				/* drain the decoders. what they held comes out of receive_audio()/receive_video() above */
+				if (input_avstream_audio_codec_context != nullptr) {
+					avcodec_send_packet(input_avstream_audio_codec_context, nullptr);
+				}
+				if (input_avstream_video_codec_context != nullptr) {
+					avcodec_send_packet(input_avstream_video_codec_context, nullptr);
+				}
 				eof_stream = true;
 				return false;
 			}
@@ -411,8 +711,7 @@ public:
 			if (input_avstream_audio != nullptr && avpkt.stream_index == input_avstream_audio->index) {
 				if (got_audio) { fprintf(stderr, "Audio content lost\n"); }
 				av_packet_rescale_ts(&avpkt, input_avstream_audio->time_base, output_avstream_audio->time_base);
-				handle_audio(/*&*/ avpkt);
-				got_audio = true;
+				handle_audio(/*&*/ avpkt);  // will set got_audio
 				break;
 			}
 			if (input_avstream_video != nullptr && avpkt.stream_index == input_avstream_video->index) {
@@ -428,25 +727,26 @@ public:
 
 		if (eof_stream) {
 			avpkt_release();
-			avpkt.size = 0;
-			avpkt.data = nullptr;
-			handle_frame(/*&*/ avpkt);  // will set got_video
-			if (!got_video) {
-				eof = true;
-			} else {
-				fprintf(stderr, "Got latent frame\n");
-			}
+			eof = true;  // drained
 		}
 
 		return true;
 	}
 	void handle_audio(AVPacket& pkt) {
-		int got_frame = 0;
-
-		if (avcodec_decode_audio4(input_avstream_audio_codec_context, input_avstream_audio_frame, &got_frame, &pkt) >=
-			0) {
-			if (got_frame != 0 && input_avstream_audio_frame->nb_samples != 0) {
-				if (input_avstream_audio_frame->pts == AV_NOPTS_VALUE) { input_avstream_audio_frame->pts = pkt.pts; }
+		if (avcodec_send_packet(input_avstream_audio_codec_context, &pkt) < 0) {
+			fprintf(stderr, "No audio decoded\n");
+		}
+		receive_audio();  // will set got_audio
+	}
+	// the next frame the audio decoder has ready, resampled into audio_dst_data. sets got_audio
+	bool receive_audio() {
+		if (input_avstream_audio_codec_context == nullptr) { return false; }
+
+		if (avcodec_receive_frame(input_avstream_audio_codec_context, input_avstream_audio_frame) >= 0) {
+			if (input_avstream_audio_frame->nb_samples != 0) {
+				if (input_avstream_audio_frame->pts == AV_NOPTS_VALUE) {
+					input_avstream_audio_frame->pts = input_avstream_audio_frame->pkt_pts;
+				}
 
 				if (input_avstream_audio_resampler != nullptr) {
 					if (input_avstream_audio_resampler_rate != input_avstream_audio_codec_context->sample_rate ||
@@ -477,7 +777,7 @@ public:
 					if (swr_init(input_avstream_audio_resampler) < 0) {
 						fprintf(stderr, "Failed to init audio resampler\n");
 						swr_free(&input_avstream_audio_resampler);
-						return;
+						return false;
 					}
 					input_avstream_audio_resampler_rate		= input_avstream_audio_codec_context->sample_rate;
 					input_avstream_audio_resampler_channels = input_avstream_audio_codec_context->channels;
@@ -529,10 +829,24 @@ public:
 					audio_dst_data_out_audio_sample = audio_sample;
 					audio_sample += audio_dst_data_out_samples;
 				}
+				got_audio = true;
 			}
 		}
+		return got_audio;
+	}
+	// hand the decoded frame to the scale stage. the decoder reuses its frame, so keep a reference of our own.
+	// if the scale stage has not picked up the previous one yet it was superseded anyway.
+	void queue_frame() {
+		if (input_avstream_video_frame_queued != nullptr) { av_frame_free(&input_avstream_video_frame_queued); }
+		input_avstream_video_frame_queued = av_frame_clone(input_avstream_video_frame);
 	}
-	void frame_copy_scale() {
+	AVFrame* take_queued_frame() {
+		AVFrame* f						  = input_avstream_video_frame_queued;
+		input_avstream_video_frame_queued = nullptr;
+		return f;
+	}
+	// scale stage
+	void frame_copy_scale(const AVFrame* src) {
 		if (input_avstream_video_frame_rgb == nullptr) {
 			fprintf(stderr, "New input frame\n");
 			input_avstream_video_frame_rgb = av_frame_alloc();
@@ -540,23 +854,48 @@ public:
 				fprintf(stderr, "Failed to alloc video frame\n");
 				return;
 			}
+		}
+		// (open_input() hands us the first frame, black, without a pool behind it)
+		if (!input_avstream_video_frame_pool.ready() &&
+			!input_avstream_video_frame_pool.init(AV_PIX_FMT_BGRA, composite_width(), output_height)) {
+			fprintf(stderr, "Failed to alloc render frame pool\n");
+			return;
+		}
 
-			input_avstream_video_frame_rgb->format = AV_PIX_FMT_BGRA;
-			input_avstream_video_frame_rgb->height = output_height;
-			input_avstream_video_frame_rgb->width  = output_width;
-			if (av_frame_get_buffer(input_avstream_video_frame_rgb, 64) < 0) {
+		// planar Y'CbCr at the output size needs neither scaling nor conversion, composite_layer() reads the
+		// planes of the decoded frame directly. it is ours (see queue_frame()), so a reference will do.
+		unsigned int hshift;
+		unsigned int vshift;
+		bool		 full_range;
+
+		if (src->width == composite_width() && src->height == output_height &&
+			ycbcr_source_format(src, hshift, vshift, full_range)) {
+			av_frame_unref(input_avstream_video_frame_rgb);
+			if (av_frame_ref(input_avstream_video_frame_rgb, src) < 0) {
+				fprintf(stderr, "Failed to reference decoded frame\n");
+				return;
+			}
+			input_avstream_video_frame_rgb->opaque = reinterpret_cast<void*>(++frame_serial);
+			return;
+		}
+
+		// the composite stage may still hold a reference to the last BGRA frame. render into a recycled buffer
+		// rather than under its feet. (the pool starts out zeroed)
+		if (input_avstream_video_frame_rgb->buf[0] == nullptr ||
+			input_avstream_video_frame_rgb->format != AV_PIX_FMT_BGRA ||
+			av_frame_is_writable(input_avstream_video_frame_rgb) == 0) {
+			av_frame_unref(input_avstream_video_frame_rgb);
+			if (!input_avstream_video_frame_pool.get(input_avstream_video_frame_rgb)) {
 				fprintf(stderr, "Failed to alloc render frame\n");
 				return;
 			}
-			memset(input_avstream_video_frame_rgb->data[0], 0,
-				input_avstream_video_frame_rgb->linesize[0] * input_avstream_video_frame_rgb->height);
 		}
 
 		if (input_avstream_video_resampler !=
 			nullptr) {  // pixel format change or width/height change = free resampler and reinit
-			if (input_avstream_video_resampler_format != input_avstream_video_frame->format ||
-				input_avstream_video_resampler_width != input_avstream_video_frame->width ||
-				input_avstream_video_resampler_height != input_avstream_video_frame->height) {
+			if (input_avstream_video_resampler_format != src->format ||
+				input_avstream_video_resampler_width != src->width ||
+				input_avstream_video_resampler_height != src->height) {
 				sws_freeContext(input_avstream_video_resampler);
 				input_avstream_video_resampler = nullptr;
 			}
@@ -565,35 +904,36 @@ public:
 		if (input_avstream_video_resampler == nullptr) {
 			input_avstream_video_resampler = sws_getContext(
 				// source
-				input_avstream_video_frame->width, input_avstream_video_frame->height,
-				static_cast<AVPixelFormat>(input_avstream_video_frame->format),
+				src->width, src->height,
+				static_cast<AVPixelFormat>(src->format),
 				// dest
 				input_avstream_video_frame_rgb->width, input_avstream_video_frame_rgb->height,
 				static_cast<AVPixelFormat>(input_avstream_video_frame_rgb->format),
-				// opt
-				SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+				// opt. scaling down to -signal-width wants a filter as wide as the ratio, which FAST_BILINEAR is not
+				signal_width > 0 ? SWS_BILINEAR : SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
 
 			if (input_avstream_video_resampler != nullptr) {
 				fprintf(stderr, "sws_getContext new context\n");
-				input_avstream_video_resampler_format = static_cast<AVPixelFormat>(input_avstream_video_frame->format);
-				input_avstream_video_resampler_width  = input_avstream_video_frame->width;
-				input_avstream_video_resampler_height = input_avstream_video_frame->height;
+				input_avstream_video_resampler_format = static_cast<AVPixelFormat>(src->format);
+				input_avstream_video_resampler_width  = src->width;
+				input_avstream_video_resampler_height = src->height;
 			} else {
 				fprintf(stderr, "sws_getContext fail\n");
 			}
 		}
 
 		if (input_avstream_video_resampler != nullptr) {
-			input_avstream_video_frame_rgb->pts				 = input_avstream_video_frame->pts;
-			input_avstream_video_frame_rgb->pkt_pts			 = input_avstream_video_frame->pkt_pts;
-			input_avstream_video_frame_rgb->pkt_dts			 = input_avstream_video_frame->pkt_dts;
-			input_avstream_video_frame_rgb->top_field_first  = input_avstream_video_frame->top_field_first;
-			input_avstream_video_frame_rgb->interlaced_frame = input_avstream_video_frame->interlaced_frame;
+			input_avstream_video_frame_rgb->pts				 = src->pts;
+			input_avstream_video_frame_rgb->pkt_pts			 = src->pkt_pts;
+			input_avstream_video_frame_rgb->pkt_dts			 = src->pkt_dts;
+			input_avstream_video_frame_rgb->top_field_first  = src->top_field_first;
+			input_avstream_video_frame_rgb->interlaced_frame = src->interlaced_frame;
+			input_avstream_video_frame_rgb->opaque			 = reinterpret_cast<void*>(++frame_serial);
 
 			if (sws_scale(input_avstream_video_resampler,
 					// source
-					input_avstream_video_frame->data, input_avstream_video_frame->linesize, 0,
-					input_avstream_video_frame->height,
+					src->data, src->linesize, 0,
+					src->height,
 					// dest
 					input_avstream_video_frame_rgb->data, input_avstream_video_frame_rgb->linesize) <= 0) {
 				fprintf(stderr, "WARNING: sws_scale failed\n");
@@ -601,16 +941,21 @@ public:
 		}
 	}
 	void handle_frame(AVPacket& pkt) {
-		int got_frame = 0;
+		if (avcodec_send_packet(input_avstream_video_codec_context, &pkt) < 0) {
+			fprintf(stderr, "No video decoded\n");
+		}
+		receive_video();  // will set got_video
+	}
+	// the next frame the video decoder has ready. sets got_video
+	bool receive_video() {
+		if (input_avstream_video_codec_context == nullptr) { return false; }
 
-		if (avcodec_decode_video2(input_avstream_video_codec_context, input_avstream_video_frame, &got_frame, &pkt) >=
-			0) {
-			if (got_frame != 0 && input_avstream_video_frame->width > 0 && input_avstream_video_frame->height > 0) {
+		if (avcodec_receive_frame(input_avstream_video_codec_context, input_avstream_video_frame) >= 0) {
+			if (input_avstream_video_frame->width > 0 && input_avstream_video_frame->height > 0) {
 				got_video = true;
 			}
-		} else {
-			fprintf(stderr, "No video decoded\n");
 		}
+		return got_video;
 	}
 	void avpkt_init() {
 		if (!avpkt_valid) {
@@ -643,6 +988,8 @@ public:
 		if (input_avstream_audio_frame != nullptr) { av_frame_free(&input_avstream_audio_frame); }
 		if (input_avstream_video_frame != nullptr) { av_frame_free(&input_avstream_video_frame); }
 		if (input_avstream_video_frame_rgb != nullptr) { av_frame_free(&input_avstream_video_frame_rgb); }
+		if (input_avstream_video_frame_queued != nullptr) { av_frame_free(&input_avstream_video_frame_queued); }
+		input_avstream_video_frame_pool.uninit();
 
 		if (input_avstream_audio_resampler != nullptr) { swr_free(&input_avstream_audio_resampler); }
 		if (input_avstream_video_resampler != nullptr) {
@@ -686,7 +1033,10 @@ public:
 	AVStream*		   input_avstream_video;				// do not free
 	AVCodecContext*	input_avstream_video_codec_context;  // do not free
 	AVFrame*		   input_avstream_video_frame;
-	AVFrame*		   input_avstream_video_frame_rgb;
+	AVFrame*		   input_avstream_video_frame_rgb;		// BGRA, or the decoded frame (see frame_copy_scale)
+	AVFrame*		   input_avstream_video_frame_queued;	// decoded, waiting for the scale stage
+	uintptr_t		   frame_serial{0};						// frames made by frame_copy_scale(), see SourceCache
+	VideoFramePool	   input_avstream_video_frame_pool;	 // buffers for input_avstream_video_frame_rgb
 	struct SwrContext* input_avstream_audio_resampler;
 	struct SwsContext* input_avstream_video_resampler;
 	AVPixelFormat	  input_avstream_video_resampler_format;
@@ -703,6 +1053,24 @@ public:
 std::vector<InputFile> input_files;
 std::string			   output_file;
 
+// the slice of the timeline to render (-ss/-se/-t, -segment K/N), so that one long render can be split across
+// machines and the pieces joined with the concat demuxer (-c copy). everything before the slice is still
+// demuxed and decoded, and its audio run through the audio emulation, but not rendered or encoded. video noise
+// follows the absolute field number and the audio state is that of a render from the start, so the pieces come
+// out as the same slices of a render of the whole.
+double			   segment_ss		   = 0;	 // -ss, seconds
+double			   segment_se		   = -1;	// -se, seconds (< 0 = to the end)
+double			   segment_t			= -1;	// -t, seconds (< 0 = to the end)
+unsigned int	   segment_index		= 0;	 // -segment K/N: K (1-based)
+unsigned int	   segment_count		= 0;	 // -segment K/N: N (0 = no -segment)
+std::string		   segment_manifest;			// -manifest, ffconcat entry for this piece
+unsigned long long segment_first_field  = 0;
+unsigned long long segment_end_field	= ULLONG_MAX;  // one past the last field
+unsigned long long segment_lead_field	= 0;		   // first field rendered (not encoded) ahead of the slice
+unsigned long long segment_first_sample = 0;
+unsigned long long segment_end_sample   = ULLONG_MAX;  // one past the last audio sample
+unsigned long long audio_written_to	 = 0;			// audio timeline position written so far
+
 InputFile& current_input_file() {
 	if (input_files.empty()) {
 		std::string what = "input files empty";
@@ -802,6 +1170,118 @@ enum
 
 int output_vhs_tape_speed = VHS_SP;
 
+// VHS video bandwidth per tape speed (VHS_SP, VHS_LP, VHS_EP), and the delay of the chroma lowpass in samples
+class VHSTapeSpeed
+{
+public:
+	float luma_cut;
+	float chroma_cut;
+	int	  chroma_delay;
+};
+
+constexpr VHSTapeSpeed vhs_tape_speeds[] = {
+	{2400000.F, 320000.F, 9},   // SP: 3.0MHz x 80%, 400KHz x 80%
+	{1900000.F, 300000.F, 12},  // LP: .., 375KHz x 80%
+	{1400000.F, 280000.F, 14},  // EP: .., 350KHz x 80%
+};
+
+enum
+{
+	SIMD_AUTO = 0,
+	SIMD_NONE,
+	SIMD_SSE41,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+int video_simd = SIMD_AUTO;  // highest SIMD level the scanline kernels may use
+
+bool test_kernels = false;  // -test-kernels: check the scanline kernels against their references, then exit
+
+int video_threads = 1;  // threads composite_layer() splits scanlines across (0 = one per CPU)
+
+int pipeline_depth = 4;  // fields in flight between each pair of render pipeline stages
+int video_fields   = 1;  // fields rendered at once, one thread each (1 = one at a time, across video_threads)
+
+enum
+{
+	WORK_INT32 = 0,
+	WORK_INT16
+};
+
+int  video_work_format   = WORK_INT32;  // sample format of the composite engine's working planes
+bool video_measure_int16 = false;		// run both formats and report how far int16 strays from int32, per stage
+bool source_cache		 = true;		// reuse the front of the chain for a source frame shown more than once
+
+unsigned long long noise_seed = 0;  // -seed, key of every noise source (same seed, same output)
+
+// noise sources. each one gets its own random stream so that adding noise in one place never shifts another.
+enum
+{
+	NOISE_VIDEO = 0,
+	NOISE_HEAD_SWITCHING,
+	NOISE_CHROMA_U,
+	NOISE_CHROMA_V,
+	NOISE_CHROMA_PHASE,
+	NOISE_CHROMA_LOSS,
+	NOISE_AUDIO_HISS,
+	NOISE_KERNEL_TEST  // -test-kernels input rows
+};
+
+// counter based random numbers (Philox 4x32, 10 rounds).
+// there is no generator state: a value is a pure function of (seed, source, index, line, position), where
+// index is the field number for video and the sample number for audio. any field can therefore be rendered on
+// any thread, in any order, and still come out bit identical -- unlike rand(), which also serializes on a lock.
+static inline void noise_block(uint32_t out[4], uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3) {
+	uint32_t k0 = static_cast<uint32_t>(noise_seed);
+	uint32_t k1 = static_cast<uint32_t>(noise_seed >> 32U);
+
+	for (unsigned int r = 0; r < 10; r++) {
+		const uint64_t p0 = static_cast<uint64_t>(0xD2511F53U) * c0;
+		const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57U) * c2;
+
+		c0 = static_cast<uint32_t>(p1 >> 32U) ^ c1 ^ k0;
+		c1 = static_cast<uint32_t>(p1);
+		c2 = static_cast<uint32_t>(p0 >> 32U) ^ c3 ^ k1;
+		c3 = static_cast<uint32_t>(p0);
+		k0 += 0x9E3779B9U;
+		k1 += 0xBB67AE85U;
+	}
+
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+// fill out[0...count-1] with values first...first+count-1 of the stream (source, index, line).
+// first must be a multiple of 4. the blocks are independent of each other, so the loop vectorizes.
+void noise_fill(uint32_t* out, unsigned int count, unsigned int source, unsigned long long index, unsigned int line,
+	unsigned int first = 0) {
+	const uint32_t c2 = static_cast<uint32_t>(index);
+	const uint32_t c3 = (static_cast<uint32_t>(index >> 32U) & 0xFFFFFFU) | (source << 24U);
+	const uint32_t b0 = first / 4U;
+	unsigned int   b;
+
+	for (b = 0; b < (count / 4U); b++) { noise_block(out + (b * 4U), b0 + b, line, c2, c3); }
+
+	if ((count % 4U) != 0) {
+		uint32_t tmp[4];
+
+		noise_block(tmp, b0 + b, line, c2, c3);
+		memcpy(out + (b * 4U), tmp, (count % 4U) * sizeof(uint32_t));
+	}
+}
+
+// a single value of the stream (source, index, line)
+static inline uint32_t noise_u32(unsigned int source, unsigned long long index, unsigned int line) {
+	uint32_t tmp[4];
+
+	noise_block(tmp, 0, line, static_cast<uint32_t>(index),
+		(static_cast<uint32_t>(index >> 32U) & 0xFFFFFFU) | (source << 24U));
+	return tmp[0];
+}
+
 void sigma(int /*x*/) {
 	if (++DIE >= 20) { abort(); }
 }
@@ -857,8 +1337,8 @@ static void help(const char* arg0) {
 	fprintf(stderr, " -comp-catv2               Composite preemphasis preset, as if CATV #2\n");
 	fprintf(stderr, " -comp-catv3               Composite preemphasis preset, as if CATV #3\n");
 	fprintf(stderr, " -comp-catv4               Composite preemphasis preset, as if CATV #4\n");
-	fprintf(stderr, " -vi                       Render video at frame rate, interlaced\n");
-	fprintf(stderr, " -vp                       Render video at field rate, progressive (with bob filter)\n");
+	fprintf(stderr, " -vi                       Render video at frame rate, interlaced (bottom field first)\n");
+	fprintf(stderr, " -vp                       Render video at field rate, progressive (default)\n");
 	fprintf(stderr, " -chroma-dropout <x>       Chroma scanline dropouts (0...10000)\n");
 	fprintf(stderr, " -vhs-linear-high-boost <x> Boost high frequencies in VHS audio (linear tracks)\n");
 	fprintf(stderr, " -vhs-head-switching <0|1> Enable/disable VHS head switching emulation\n");
@@ -869,14 +1349,45 @@ static void help(const char* arg0) {
 	fprintf(stderr, " -ss <t>                   Start transcoding from t seconds\n");
 	fprintf(stderr, " -se <t>                   Stop transcoding at t seconds\n");
 	fprintf(stderr, " -t <t>                    Transcode only t seconds\n");
+	fprintf(stderr, " -segment <K/N>            Render only the K'th of N equal parts of the first input\n");
+	fprintf(stderr, " -manifest <file>          ffconcat entry for the part (default <output file>.ffconcat)\n");
 	fprintf(stderr, " -in-composite-lowpass <n> Enable/disable chroma lowpass on composite in\n");
 	fprintf(stderr, " -out-composite-lowpass <n> Enable/disable chroma lowpass on composite out\n");
 	fprintf(stderr, " -out-composite-lowpass-lite <n> Enable/disable chroma lowpass on composite out (lite)\n");
 	fprintf(stderr, " -bkey-feedback <n>        Black key feedback (black level <= N)\n");
 	fprintf(stderr, " -comp-phase <n>           NTSC subcarrier phase per scanline (0, 90, 180, or 270)\n");
+	fprintf(stderr, " -threads <n>              Render each field on n threads (0 = one per CPU, default 1)\n");
+	fprintf(stderr, " -simd <auto|none|sse4.1|avx2|avx512> Highest SIMD level for scanline kernels\n");
+	fprintf(stderr, " -test-kernels             Check the SIMD scanline kernels against the scalar ones and exit\n");
+	fprintf(stderr, " -fields <n>               Render n fields at once, one thread each (default 1)\n");
+	fprintf(stderr, " -pipeline-depth <n>       Fields queued between render pipeline stages (default 4)\n");
+	fprintf(stderr, " -seed <n>                 Seed for all video/audio noise (default 0)\n");
+	fprintf(stderr, " -work-format <int32|int16> Sample format of the composite working planes\n");
+	fprintf(stderr, " -measure-int16            Also render in int16 and report its deviation per stage\n");
+	fprintf(stderr, " -source-cache <n>         Reuse YIQ of a source frame shown more than once (default 1)\n");
+	fprintf(stderr, " -signal-width <n|4fsc>    Composite at n samples per scanline, then scale to the output\n");
+	fprintf(stderr, "                           (4fsc = 768, the rate the filters model; default off)\n");
+	fprintf(stderr, " -encoder-preset <archive|intermediate|delivery> FFV1 lossless, ProRes 422 HQ or H.264 4:2:0\n");
+	fprintf(stderr, "                           (before the encoder options below, which change single settings)\n");
+	fprintf(stderr, " -vcodec <name>            Video encoder (default libx264; ffv1, rawvideo, prores_ks, ...)\n");
+	fprintf(stderr, " -pix-fmt <fmt>            Encoder pixel format (default yuv444p if the encoder takes it)\n");
+	fprintf(stderr, " -crf <n>                  Constant rate factor (default 0, lossless; -1 = encoder default)\n");
+	fprintf(stderr, " -vb <n>[k|M]              Video bitrate in bits/second, instead of -crf\n");
+	fprintf(stderr, " -vpreset <name>           Encoder speed preset (default ultrafast, \"\" = encoder default)\n");
+	fprintf(stderr, " -vtune <name>             Encoder tuning (default zerolatency, \"\" = none)\n");
+	fprintf(stderr, " -vopts <k=v:k=v...>       More encoder options\n");
+	fprintf(stderr, " -encode-threads <n>       Encoder threads (0 = one per CPU, default 0)\n");
+	fprintf(stderr, " -encode-thread-type <frame|slice|auto> How the encoder threads split the work\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, " Output file will be up/down converted to 720x480 (NTSC 29.97fps) or 720x576 (PAL 25fps).\n");
 	fprintf(stderr, " Output will be rendered as interlaced video.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, " A part rendered with -ss/-se/-t or -segment matches the same slice of a full render.\n");
+	fprintf(stderr, " Join the parts losslessly with the concat demuxer, listing the manifests in part order\n");
+	fprintf(stderr, " (a shell glob puts part10 before part2):\n");
+	fprintf(stderr, "   cat part1.mkv.ffconcat part2.mkv.ffconcat ... > all.ffconcat\n");
+	fprintf(stderr, "   ffmpeg -f concat -i all.ffconcat -c copy out.mkv\n");
+	fprintf(stderr, " The manifests have no \"ffconcat version 1.0\" header, so -f concat is needed.\n");
 }
 
 static unsigned long long audio_proc_count = 0;
@@ -947,9 +1458,9 @@ void composite_audio_process(
 
 			/* hiss */
 			if (output_audio_hiss_level != 0) {
-				s += (static_cast<float>(
-						 (static_cast<int>(static_cast<unsigned int>(rand()) % ((output_audio_hiss_level * 2) + 1))) -
-						 output_audio_hiss_level)) /
+				s += (static_cast<float>((static_cast<int>(noise_u32(NOISE_AUDIO_HISS, audio_proc_count, c) %
+											   ((output_audio_hiss_level * 2) + 1))) -
+									   output_audio_hiss_level)) /
 					 20000;
 			}
 
@@ -995,11 +1506,89 @@ static int parse_argv(int argc, char** argv) {
 					fprintf(stderr, "Invalid phase\n");
 					return 1;
 				}
+			} else if (strcmp(a, "threads") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				video_threads = atoi(a);
+				if (video_threads < 0 || video_threads > 1024) {
+					fprintf(stderr, "Invalid thread count\n");
+					return 1;
+				}
+			} else if (strcmp(a, "fields") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				video_fields = atoi(a);
+				if (video_fields < 1 || video_fields > 256) {
+					fprintf(stderr, "Invalid field count\n");
+					return 1;
+				}
+			} else if (strcmp(a, "pipeline-depth") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				pipeline_depth = atoi(a);
+				if (pipeline_depth < 1 || pipeline_depth > 256) {
+					fprintf(stderr, "Invalid pipeline depth\n");
+					return 1;
+				}
+			} else if (strcmp(a, "work-format") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+
+				if (strcmp(a, "int32") == 0) {
+					video_work_format = WORK_INT32;
+				} else if (strcmp(a, "int16") == 0) {
+					video_work_format = WORK_INT16;
+				} else {
+					fprintf(stderr, "Unknown working format '%s'\n", a);
+					return 1;
+				}
+			} else if (strcmp(a, "measure-int16") == 0) {
+				video_measure_int16 = true;
+			} else if (strcmp(a, "source-cache") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				source_cache = atoi(a) > 0;
+			} else if (strcmp(a, "seed") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				noise_seed = strtoull(a, nullptr, 0);
+			} else if (strcmp(a, "test-kernels") == 0) {
+				test_kernels = true;
+			} else if (strcmp(a, "simd") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+
+				if (strcmp(a, "auto") == 0) {
+					video_simd = SIMD_AUTO;
+				} else if (strcmp(a, "none") == 0) {
+					video_simd = SIMD_NONE;
+				} else if (strcmp(a, "sse4.1") == 0) {
+					video_simd = SIMD_SSE41;
+				} else if (strcmp(a, "avx2") == 0) {
+					video_simd = SIMD_AVX2;
+				} else if (strcmp(a, "avx512") == 0) {
+					video_simd = SIMD_AVX512;
+				} else {
+					fprintf(stderr, "Unknown SIMD level '%s'\n", a);
+					return 1;
+				}
 			} else if (strcmp(a, "width") == 0) {
 				a = argv[i++];
 				if (a == nullptr) { return 1; }
 				output_width = static_cast<int>(strtoul(a, nullptr, 0));
 				if (output_width < 32) { return 1; }
+			} else if (strcmp(a, "signal-width") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				if (strcmp(a, "4fsc") == 0) {
+					signal_width = 768;  // active samples of a scanline at 4x the subcarrier, the rate of the filters
+				} else {
+					signal_width = atoi(a);
+				}
+				if (signal_width != 0 && signal_width < 32) {
+					fprintf(stderr, "Invalid signal width\n");
+					return 1;
+				}
 			} else if (strcmp(a, "d") == 0) {
 				a = argv[i++];
 				if (a == nullptr) { return 1; }
@@ -1033,6 +1622,111 @@ static int parse_argv(int argc, char** argv) {
 				composite_out_chroma_lowpass = atoi(argv[i++]) > 0;
 			} else if (strcmp(a, "out-composite-lowpass-lite") == 0) {
 				composite_out_chroma_lowpass_lite = atoi(argv[i++]) > 0;
+			} else if (strcmp(a, "ss") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				segment_ss = atof(a);
+				if (segment_ss < 0) { return 1; }
+			} else if (strcmp(a, "se") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				segment_se = atof(a);
+				if (segment_se < 0) { return 1; }
+			} else if (strcmp(a, "t") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				segment_t = atof(a);
+				if (segment_t < 0) { return 1; }
+			} else if (strcmp(a, "segment") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				if (sscanf(a, "%u/%u", &segment_index, &segment_count) != 2 || segment_count == 0 ||
+					segment_index < 1 || segment_index > segment_count) {
+					fprintf(stderr, "Invalid segment '%s', want K/N with 1 <= K <= N\n", a);
+					return 1;
+				}
+			} else if (strcmp(a, "manifest") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				segment_manifest = a;
+			} else if (strcmp(a, "encoder-preset") == 0) {
+				const EncoderPreset* preset = nullptr;
+
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				for (const auto& p : encoder_presets) {
+					if (strcmp(a, p.name) == 0) { preset = &p; }
+				}
+				if (preset == nullptr) {
+					fprintf(stderr, "Unknown encoder preset '%s'\n", a);
+					return 1;
+				}
+				output_video_encoder = preset->settings;
+			} else if (strcmp(a, "vcodec") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				output_video_encoder.codec = a;
+			} else if (strcmp(a, "pix-fmt") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				output_video_encoder.pix_fmt = a;
+			} else if (strcmp(a, "crf") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				output_video_encoder.crf	 = atoi(a);
+				output_video_encoder.bitrate = 0;
+			} else if (strcmp(a, "vb") == 0) {
+				char* end;
+
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				output_video_encoder.bitrate = static_cast<int64_t>(strtod(a, &end));
+				if (*end == 'k' || *end == 'K') {
+					output_video_encoder.bitrate *= 1000;
+				} else if (*end == 'm' || *end == 'M') {
+					output_video_encoder.bitrate *= 1000000;
+				}
+				if (output_video_encoder.bitrate <= 0) {
+					fprintf(stderr, "Invalid bitrate '%s'\n", a);
+					return 1;
+				}
+				output_video_encoder.crf = -1;
+			} else if (strcmp(a, "vpreset") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				output_video_encoder.preset = a;
+			} else if (strcmp(a, "vtune") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				output_video_encoder.tune = a;
+			} else if (strcmp(a, "vopts") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				if (!output_video_encoder.options.empty()) { output_video_encoder.options += ":"; }
+				output_video_encoder.options += a;
+			} else if (strcmp(a, "encode-threads") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+				output_video_encoder.threads = atoi(a);
+				if (output_video_encoder.threads < 0) { return 1; }
+			} else if (strcmp(a, "encode-thread-type") == 0) {
+				a = argv[i++];
+				if (a == nullptr) { return 1; }
+
+				if (strcmp(a, "frame") == 0) {
+					output_video_encoder.thread_type = FF_THREAD_FRAME;
+				} else if (strcmp(a, "slice") == 0) {
+					output_video_encoder.thread_type = FF_THREAD_SLICE;
+				} else if (strcmp(a, "auto") == 0) {
+					output_video_encoder.thread_type = 0;
+				} else {
+					fprintf(stderr, "Unknown encoder thread type '%s'\n", a);
+					return 1;
+				}
+			} else if (strcmp(a, "vi") == 0) {
+				output_video_as_interlaced = true;
+			} else if (strcmp(a, "vp") == 0) {
+				output_video_as_interlaced = false;
 			} else if (strcmp(a, "nocomp") == 0) {
 				enable_composite_emulation = false;
 				enable_audio_emulation	 = false;
@@ -1071,7 +1765,7 @@ static int parse_argv(int argc, char** argv) {
 				output_audio_linear_buzz = atof(argv[i++]);
 			} else if (strcmp(a, "chroma-phase-noise") == 0) {
 				int x					 = atoi(argv[i++]);
-				video_chroma_phase_noise = x;
+				video_chroma_phase_noise = std::max(x, 0);
 			} else if (strcmp(a, "yc-recomb") == 0) {
 				video_yc_recombine = atof(argv[i++]);
 			} else if (strcmp(a, "audio-hiss") == 0) {
@@ -1217,6 +1911,7 @@ static int parse_argv(int argc, char** argv) {
 	fprintf(stderr, "VHS head switching point: %.6f\n", vhs_head_switching_phase);
 	fprintf(stderr, "VHS head switching noise: %.6f\n", vhs_head_switching_phase_noise);
 
+	if (test_kernels) { return 0; }
 	if (output_file.empty()) {
 		fprintf(stderr, "No output file specified\n");
 		return 1;
@@ -1237,6 +1932,36 @@ void process_audio(InputFile& fin) {
 	}
 }
 
+void mux_audio_packet(AVPacket& pkt);
+
+// write samples [pos, pos + count) of the audio timeline (silence if data == nullptr), or the part of them that
+// falls within the slice being rendered. timestamps start from the slice.
+static void write_audio_span(const uint8_t* data, unsigned long long pos, unsigned long long count) {
+	const unsigned long long bytes = 2 * output_audio_channels;
+	const unsigned long long b	 = std::max(pos, segment_first_sample);
+	const unsigned long long e	 = std::min(pos + count, segment_end_sample);
+
+	if (e > audio_written_to) { audio_written_to = e; }
+	if (b >= e) { return; }
+
+	AVPacket dstpkt;
+	av_init_packet(&dstpkt);
+	if (av_new_packet(&dstpkt, (e - b) * bytes) >= 0) {  // NTS: Will reset fields too!
+		assert(dstpkt.data != nullptr);
+		assert(dstpkt.size >= ((e - b) * bytes));
+		if (data != nullptr) {
+			memcpy(dstpkt.data, data + ((b - pos) * bytes), (e - b) * bytes);
+		} else {
+			memset(dstpkt.data, 0, (e - b) * bytes);
+		}
+	}
+	dstpkt.pts			= b - segment_first_sample;
+	dstpkt.dts			= b - segment_first_sample;
+	dstpkt.stream_index = output_avstream_audio->index;
+	av_packet_rescale_ts(&dstpkt, output_avstream_audio_codec_context->time_base, output_avstream_audio->time_base);
+	mux_audio_packet(dstpkt);
+}
+
 void write_out_audio(InputFile& fin) {
 	if (fin.audio_dst_data == nullptr || fin.audio_dst_data_out_samples == 0) { return; }
 
@@ -1246,19 +1971,7 @@ void write_out_audio(InputFile& fin) {
 
 		if (out_samples > output_audio_rate) { out_samples = output_audio_rate; }
 
-		AVPacket dstpkt;
-		av_init_packet(&dstpkt);
-		if (av_new_packet(&dstpkt, out_samples * 2 * output_audio_channels) >= 0) {  // NTS: Will reset fields too!
-			assert(dstpkt.data != nullptr);
-			assert(dstpkt.size >= (out_samples * 2 * output_audio_channels));
-			memset(dstpkt.data, 0, out_samples * 2 * output_audio_channels);
-		}
-		dstpkt.pts			= fin.last_written_sample;
-		dstpkt.dts			= fin.last_written_sample;
-		dstpkt.stream_index = output_avstream_audio->index;
-		av_packet_rescale_ts(&dstpkt, output_avstream_audio_codec_context->time_base, output_avstream_audio->time_base);
-		if (av_interleaved_write_frame(output_avfmt, &dstpkt) < 0) { fprintf(stderr, "Failed to write frame\n"); }
-		av_packet_unref(&dstpkt);
+		write_audio_span(nullptr, fin.last_written_sample, out_samples);
 
 		fprintf(stderr, "Pad fill %llu samples\n", out_samples);
 		fin.last_written_sample += out_samples;
@@ -1266,299 +1979,2528 @@ void write_out_audio(InputFile& fin) {
 
 	// write it out. TODO: At some point, support conversion to whatever the codec needs and then convert to it.
 	// that way we can render directly to MP4 our VHS emulation.
-	AVPacket dstpkt;
-	av_init_packet(&dstpkt);
-	if (av_new_packet(&dstpkt, fin.audio_dst_data_out_samples * 2 * output_audio_channels) >=
-		0) {  // NTS: Will reset fields too!
-		assert(dstpkt.data != nullptr);
-		assert(dstpkt.size >= (fin.audio_dst_data_out_samples * 2 * output_audio_channels));
-		memcpy(dstpkt.data, fin.audio_dst_data[0], fin.audio_dst_data_out_samples * 2 * output_audio_channels);
-	}
-	dstpkt.pts			= fin.audio_dst_data_out_audio_sample;
-	dstpkt.dts			= fin.audio_dst_data_out_audio_sample;
-	dstpkt.stream_index = output_avstream_audio->index;
-	av_packet_rescale_ts(&dstpkt, output_avstream_audio_codec_context->time_base, output_avstream_audio->time_base);
-	if (av_interleaved_write_frame(output_avfmt, &dstpkt) < 0) { fprintf(stderr, "Failed to write frame\n"); }
-	av_packet_unref(&dstpkt);
+	write_audio_span(fin.audio_dst_data[0], fin.audio_dst_data_out_audio_sample, fin.audio_dst_data_out_samples);
 
 	fin.audio_sample = fin.last_written_sample = fin.audio_dst_data_out_audio_sample + fin.audio_dst_data_out_samples;
 }
 
-void output_frame(AVFrame* frame, unsigned long long field_number) {
-	int		 gotit = 0;
-	AVPacket pkt;
-
-	av_init_packet(&pkt);
-	if (av_new_packet(&pkt, 50000000 / 8) < 0) {
-		fprintf(stderr, "Failed to alloc vid packet\n");
-		return;
-	}
+// working sample formats of the composite engine (-work-format).
+// int is the reference. int16_t holds the same signal at 1/4 the scale (luma 0...16320, see RGB_to_YIQ) so that
+// it fits with headroom, which doubles the samples per vector and halves the memory traffic of every stage.
+// the int16 stages saturate (clamp) wherever the signal can leave that range: after the subcarrier is added to
+// luma, after filters that boost, and after noise is added.
+template <typename T>
+class WorkFormat;
 
-	frame->key_frame = (field_number % (15ULL * 2ULL)) == 0 ? 1 : 0;
+template <>
+class WorkFormat<int>
+{
+public:
+	static constexpr int shift = 0;
 
-	{
-		frame->interlaced_frame = 0;
-		frame->pts				= field_number;
-		pkt.pts					= field_number;
-		pkt.dts					= field_number;
-	}
+public:
+	static inline int clamp(const int v) { return v; }
+	static inline int fclamp(const float v) { return static_cast<int>(v); }
+};
 
-	fprintf(stderr,
-		"\x0D"
-		"Output field %llu ",
-		field_number);
-	fflush(stderr);
-	if (avcodec_encode_video2(output_avstream_video_codec_context, &pkt, frame, &gotit) == 0) {
-		if (gotit != 0) {
-			pkt.stream_index = output_avstream_video->index;
-			av_packet_rescale_ts(
-				&pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
+template <>
+class WorkFormat<int16_t>
+{
+public:
+	static constexpr int shift = 2;
 
-			if (av_interleaved_write_frame(output_avfmt, &pkt) < 0) {
-				fprintf(stderr, "AV write frame failed video\n");
-			}
-		}
+public:
+	static inline int16_t clamp(const int v) { return static_cast<int16_t>(std::min(std::max(v, -32768), 32767)); }
+	static inline int16_t fclamp(const float v) {
+		return static_cast<int16_t>(std::min(std::max(v, -32768.F), 32767.F));
 	}
+};
+
+// one working plane of a single field.
+// only the scanlines of the field being rendered are stored, back to back, so frame scanline y
+// (y = field, field + 2, field + 4, ...) lives at compact row y / 2. stages index it only through row().
+template <typename T>
+class FieldPlane
+{
+public:
+	T* row(const unsigned int y) const { return base + (static_cast<size_t>(y >> 1U) * stride); }
+
+public:
+	T*	 base{nullptr};
+	size_t stride{0};  // samples per row, including padding
+};
+
+template <typename T>
+class FieldPlanes
+{
+public:
+	FieldPlane<T> Y, I, Q;
+};
+
+// working Y/I/Q planes for composite_layer().
+// allocated ONCE (sized to the output frame) and reused for every field instead of new[]/delete[] per field.
+// the planes live in one cache line aligned block, which is also aligned and advised for transparent
+// huge pages so that a 1080p/4K working set does not take thousands of page faults per field.
+// only the working format(s) in use get planes: int, int16_t, or both for -measure-int16.
+class CompositePlaneArena
+{
+public:
+	static constexpr size_t cache_line = 64;
+	static constexpr size_t huge_page  = 2 * 1024 * 1024;
+
+public:
+	CompositePlaneArena() = default;
+	~CompositePlaneArena() { freeplanes(); }
+	CompositePlaneArena(const CompositePlaneArena&) = delete;
+	CompositePlaneArena& operator=(const CompositePlaneArena&) = delete;
+	bool allocplanes(const unsigned int w, const unsigned int h) {
+		if (base != nullptr && w == width && h == height) { return true; }
+
+		freeplanes();
+		width  = w;
+		height = h;
+		if (width == 0 || height == 0) { return false; }
+
+		const bool need32 = (video_work_format == WORK_INT32) || video_measure_int16;
+		const bool need16 = (video_work_format == WORK_INT16) || video_measure_int16;
+
+		// field-compact: (height + 1) / 2 rows covers the taller of the two fields.
+		// rows are padded to a whole number of cache lines so every scanline starts on one.
+		rows	  = (height + 1U) / 2U;
+		base_size = 0;
+		if (need32) { base_size += planebytes<int>() * 3; }
+		if (need16) { base_size += planebytes<int16_t>() * 3; }
+		base_size = (base_size + huge_page - 1) & ~(huge_page - 1);
+
+		void* p = nullptr;
+		if (posix_memalign(&p, huge_page, base_size) != 0) {
+			fprintf(stderr, "Failed to alloc composite planes\n");
+			width = height = 0;
+			return false;
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(p, base_size, MADV_HUGEPAGE);
+#endif
+		// zero the planes ONCE. this also faults in every page up front instead of during the first field.
+		// nothing has to be cleared per field: every stage of composite_layer() only reads scanlines of the
+		// current field, and the RGB to YIQ conversion writes all of those before anything else reads them.
+		memset(p, 0, base_size);
+
+		base = static_cast<unsigned char*>(p);
+
+		unsigned char* at = base;
+		if (need32) { carveplanes(planes, at); }
+		if (need16) { carveplanes(planes16, at); }
+		return true;
+	}
+	template <typename T>
+	FieldPlanes<T>& of() {
+		if constexpr (std::is_same<T, int16_t>::value) {
+			return planes16;
+		} else {
+			return planes;
+		}
+	}
+	void freeplanes() {
+		if (base != nullptr) { free(base); }
+		base	  = nullptr;
+		planes	= FieldPlanes<int>();
+		planes16  = FieldPlanes<int16_t>();
+		base_size = 0;
+		width = height = rows = 0;
+	}
+
+private:
+	template <typename T>
+	size_t stride() const {
+		return ((((static_cast<size_t>(width) * sizeof(T)) + cache_line - 1) / cache_line) * cache_line) / sizeof(T);
+	}
+	template <typename T>
+	size_t planebytes() const {
+		return stride<T>() * rows * sizeof(T);
+	}
+	template <typename T>
+	void carveplanes(FieldPlanes<T>& fp, unsigned char*& at) {
+		fp.Y.base = reinterpret_cast<T*>(at);
+		fp.I.base = reinterpret_cast<T*>(at + planebytes<T>());
+		fp.Q.base = reinterpret_cast<T*>(at + (planebytes<T>() * 2));
+		fp.Y.stride = fp.I.stride = fp.Q.stride = stride<T>();
+		at += planebytes<T>() * 3;
+	}
+
+public:
+	unsigned int		 width{0};
+	unsigned int		 height{0};
+	unsigned int		 rows{0};	   // scanlines per field plane
+	size_t				 base_size{0};  // bytes
+	unsigned char*		 base{nullptr};
+	FieldPlanes<int>	 planes;	// -work-format int32 (and -measure-int16)
+	FieldPlanes<int16_t> planes16;  // -work-format int16 (and -measure-int16)
+};
+
+// -source-cache: a source frame that stays up for more than two fields (below 24 fps, stills) is rendered into
+// the same field parity more than once, and the front of the chain (the conversion to YIQ and the composite in
+// lowpass) comes out the same every time. the planes after it are kept per input file and parity, keyed by the
+// serial the scale stage gives every frame it makes (AVFrame::opaque), and copied back in instead of redone.
+// only with the composite in lowpass on: without it, the copy costs about what the conversion does.
+std::atomic<unsigned long long> source_cache_lookups{0};
+std::atomic<unsigned long long> source_cache_hits{0};
+
+// what composite_strip_front() does with the front of the chain for this field
+class FrontCache
+{
+public:
+	CompositePlaneArena* planes{nullptr};  // nullptr: no caching
+	bool				 hit{false};	   // planes already holds the front of this source and parity
+};
+
+class SourceCache
+{
+public:
+	class Slot
+	{
+	public:
+		unsigned long long  serial{0};		// last source frame seen
+		bool				filled{false};	// planes hold the front of it
+		bool				repeated{true};  // it was seen more than once (assumed for the first frame)
+		CompositePlaneArena planes;
+	};
+
+public:
+	// filling costs a copy of the planes, about what a hit saves, so a new source frame is only kept if the one
+	// before it on this parity came back: the frame rate decides that, and it does not change from frame to frame.
+	// 30p in 60i never repeats a parity and is never filled, 3:2 pulldown repeats once in 5 frames and is not worth it.
+	FrontCache lookup(const InputFile* layer, const unsigned int field, const unsigned long long serial,
+		const unsigned int w, const unsigned int h) {
+		FrontCache fc;
+
+		if (serial == 0) { return fc; }  // not made by the scale stage
+
+		Slot& slot = slots[std::make_pair(layer, field & 1U)];
+
+		source_cache_lookups++;
+		if (slot.planes.width != w || slot.planes.height != h) { slot.filled = false; }
+		if (slot.serial == serial) {
+			slot.repeated = true;
+			if (slot.filled) {
+				source_cache_hits++;
+				fc.planes = &slot.planes;
+				fc.hit	= true;
+			}
+			return fc;
+		}
+
+		const bool fill = slot.repeated;
+
+		slot.serial	= serial;
+		slot.filled	= false;
+		slot.repeated = false;
+		if (!fill || !slot.planes.allocplanes(w, h)) { return fc; }
+		slot.filled = true;  // by this field
+		fc.planes	= &slot.planes;
+		return fc;
+	}
+
+private:
+	std::map<std::pair<const InputFile*, unsigned int>, Slot> slots;
+};
+
+// state owned by the renderer that outlives a single composite_layer() call
+class CompositeRenderContext
+{
+public:
+	CompositePlaneArena arena;
+	SourceCache			sources;
+};
+
+CompositeRenderContext composite_render_context;
+
+// RGB <-> YIQ in fixed point.
+//
+// RGB to YIQ: Y = 256 * (0.30r + 0.59g + 0.11b), and I/Q with dY substituted in, so that every output is a
+// single 3-tap dot product. coefficients are scaled by 256 << 14 and the result is truncated toward zero,
+// which is what the cast from double did. the sums stay below 2^31 for any 8-bit input.
+//
+// YIQ to RGB: the coefficients are scaled by 4096 and the result is shifted down by 12 + 8 bits (the / 256).
+// the shift rounds down where the double math truncated toward zero, but that only matters below zero and
+// those values clamp to 0 anyway.
+//
+// both agree with the original double precision formulas to within 1 LSB.
+//
+// YIQ to Y'CbCr (SMPTE 170M, limited range, what the encoder gets): Y' = 16 + (219 / 255) * Y, and Cb/Cr are the
+// B - Y and R - Y of YIQ to RGB scaled by 224 / (255 * 1.772) and 224 / (255 * 1.402), in the same 12 + 8 bit fixed
+// point. rounded to nearest and clamped to the nominal range, which is where RGB clamped to 0...255 ended up.
+//
+// Y'CbCr to YIQ (decoded frames read as they are, see ycbcr_source_format()): BT.601 Y'CbCr to R'G'B', which is
+// what swscale assumes for these formats, followed by the RGB to YIQ weights above, folded into a single matrix
+// at compile time. Y comes out at the scale of RGB to YIQ and rounded to nearest. R'G'B' is not clipped on the
+// way, so colors outside of the RGB cube carry through. I and Q do not depend on Y' (their weights sum to 0).
+static constexpr int yiq_in_shift  = 14;
+static constexpr int yiq_in_Yr	 = 1258291;   //  0.30   * 256 << 14
+static constexpr int yiq_in_Yg	 = 2474640;   //  0.59   * 256 << 14  (rounded up so Y sums to exactly 256 << 14)
+static constexpr int yiq_in_Yb	 = 461373;	//  0.11   * 256 << 14
+static constexpr int yiq_in_Ir	 = 2512388;   //  0.599  * 256 << 14  (0.74 - 0.47 * 0.30)
+static constexpr int yiq_in_Ig	 = -1163080;  // -0.2773 * 256 << 14  (     - 0.47 * 0.59)
+static constexpr int yiq_in_Ib	 = -1349308;  // -0.3217 * 256 << 14  (-0.27 - 0.47 * 0.11)
+static constexpr int yiq_in_Qr	 = 893387;	//  0.213  * 256 << 14  (0.48 - 0.89 * 0.30)
+static constexpr int yiq_in_Qg	 = -2202429;  // -0.5251 * 256 << 14  (     - 0.89 * 0.59)
+static constexpr int yiq_in_Qb	 = 1309042;   //  0.3121 * 256 << 14  (0.41 - 0.89 * 0.11)
+static constexpr int yiq_out_shift = 12 + 8;
+static constexpr int yiq_out_rI	= 3916;   //  0.956 * 4096
+static constexpr int yiq_out_rQ	= 2544;   //  0.621 * 4096
+static constexpr int yiq_out_gI	= -1114;  // -0.272 * 4096
+static constexpr int yiq_out_gQ	= -2650;  // -0.647 * 4096
+static constexpr int yiq_out_bI	= -4530;  // -1.106 * 4096
+static constexpr int yiq_out_bQ	= 6975;   //  1.703 * 4096
+static constexpr int ycbcr_out_Y	= 3518;   //  219 / 255 * 4096
+static constexpr int ycbcr_out_bI   = -2246;  // yiq_out_bI * 224 / (255 * 1.772)
+static constexpr int ycbcr_out_bQ   = 3458;   // yiq_out_bQ * 224 / (255 * 1.772)
+static constexpr int ycbcr_out_rI   = 2454;   // yiq_out_rI * 224 / (255 * 1.402)
+static constexpr int ycbcr_out_rQ   = 1594;   // yiq_out_rQ * 224 / (255 * 1.402)
+static constexpr int ycbcr_out_Y0   = (16 << yiq_out_shift) + (1 << (yiq_out_shift - 1));   // black, + 0.5
+static constexpr int ycbcr_out_C0   = (128 << yiq_out_shift) + (1 << (yiq_out_shift - 1));  // no color, + 0.5
+static constexpr int ycbcr_in_shift = 14;
+
+class YCbCrToYIQ
+{
+public:
+	int Yy, Ycb, Ycr, Y0;  // Y = ((Yy * y) + (Ycb * cb) + (Ycr * cr) + Y0) >> ycbcr_in_shift
+	int Icb, Icr, I0;
+	int Qcb, Qcr, Q0;
+};
+
+static constexpr int ycbcr_in_fixed(const double v) {
+	return static_cast<int>(v < 0 ? (v - 0.5) : (v + 0.5));
+}
+
+// weights (wr, wg, wb) of RGB to YIQ applied to what one unit of Cb or Cr adds to R', G' and B', times k
+static constexpr int ycbcr_in_coef(double wr, double wg, double wb, double r, double g, double b, double k) {
+	return ycbcr_in_fixed(((wr * r) + (wg * g) + (wb * b)) * k * 256.0 * (1 << ycbcr_in_shift));
+}
+
+// ky, kc: R'G'B' units per step of Y' and of Cb/Cr. black: Y' of black.
+static constexpr YCbCrToYIQ ycbcr_in_matrix(const double ky, const double kc, const int black) {
+	constexpr double bG = -0.114 * 1.772 / 0.587;  // G' from Cb
+	constexpr double rG = -0.299 * 1.402 / 0.587;  // G' from Cr
+	YCbCrToYIQ		 m{};
+
+	m.Yy  = ycbcr_in_fixed(ky * 256.0 * (1 << ycbcr_in_shift));
+	m.Ycb = ycbcr_in_coef(0.30, 0.59, 0.11, 0.0, bG, 1.772, kc);
+	m.Ycr = ycbcr_in_coef(0.30, 0.59, 0.11, 1.402, rG, 0.0, kc);
+	m.Icb = ycbcr_in_coef(0.599, -0.2773, -0.3217, 0.0, bG, 1.772, kc);
+	m.Icr = ycbcr_in_coef(0.599, -0.2773, -0.3217, 1.402, rG, 0.0, kc);
+	m.Qcb = ycbcr_in_coef(0.213, -0.5251, 0.3121, 0.0, bG, 1.772, kc);
+	m.Qcr = ycbcr_in_coef(0.213, -0.5251, 0.3121, 1.402, rG, 0.0, kc);
+	m.Y0  = (1 << (ycbcr_in_shift - 1)) - (black * m.Yy) - (128 * (m.Ycb + m.Ycr));
+	m.I0  = (1 << (ycbcr_in_shift - 1)) - (128 * (m.Icb + m.Icr));
+	m.Q0  = (1 << (ycbcr_in_shift - 1)) - (128 * (m.Qcb + m.Qcr));
+	return m;
+}
+
+static constexpr YCbCrToYIQ ycbcr_in_limited = ycbcr_in_matrix(255.0 / 219.0, 255.0 / 224.0, 16);  // 16...235
+static constexpr YCbCrToYIQ ycbcr_in_full	= ycbcr_in_matrix(1.0, 1.0, 0);						// JPEG range
+
+static inline int yiq_in_trunc(const int v) {
+	return (v + ((v >> 31) & ((1 << yiq_in_shift) - 1))) >> yiq_in_shift;  // divide, rounding toward zero
+}
+
+static inline int yiq_out_clamp(const int v) {
+	if (v < 0) { return 0; }
+	if (v > 255) { return 255; }
+
+	return v;
+}
 
-	av_packet_unref(&pkt);
-}
-
 void RGB_to_YIQ(int& Y, int& I, int& Q, int r, int g, int b) {
-	double dY;
+	Y = yiq_in_trunc((yiq_in_Yr * r) + (yiq_in_Yg * g) + (yiq_in_Yb * b));
+	I = yiq_in_trunc((yiq_in_Ir * r) + (yiq_in_Ig * g) + (yiq_in_Ib * b));
+	Q = yiq_in_trunc((yiq_in_Qr * r) + (yiq_in_Qg * g) + (yiq_in_Qb * b));
+}
+
+void YIQ_to_RGB(int& r, int& g, int& b, int Y, int I, int Q) {
+	const int sY = Y << 12;
+
+	r = yiq_out_clamp((sY + (yiq_out_rI * I) + (yiq_out_rQ * Q)) >> yiq_out_shift);
+	g = yiq_out_clamp((sY + (yiq_out_gI * I) + (yiq_out_gQ * Q)) >> yiq_out_shift);
+	b = yiq_out_clamp((sY + (yiq_out_bI * I) + (yiq_out_bQ * Q)) >> yiq_out_shift);
+}
+
+static inline int ycbcr_out_clamp(const int v, const int lo, const int hi) { return std::min(std::max(v, lo), hi); }
+
+void YIQ_to_YCbCr(int& y, int& cb, int& cr, int Y, int I, int Q) {
+	y  = ycbcr_out_clamp(((ycbcr_out_Y * Y) + ycbcr_out_Y0) >> yiq_out_shift, 16, 235);
+	cb = ycbcr_out_clamp(((ycbcr_out_bI * I) + (ycbcr_out_bQ * Q) + ycbcr_out_C0) >> yiq_out_shift, 16, 240);
+	cr = ycbcr_out_clamp(((ycbcr_out_rI * I) + (ycbcr_out_rQ * Q) + ycbcr_out_C0) >> yiq_out_shift, 16, 240);
+}
+
+// whole scanline converters. src is the BGRA row of the input AVFrame (B in the low byte), dst the rows of the
+// three planes of the YUV444P output frame. the Y/I/Q rows come from FieldPlane::row(). alpha is ignored.
+using RGB_to_YIQ_row_func = void (*)(int* Y, int* I, int* Q, const uint32_t* src, unsigned int width);
+using YIQ_to_YCbCr_row_func = void (*)(
+	uint8_t* dY, uint8_t* dCb, uint8_t* dCr, const int* Y, const int* I, const int* Q, unsigned int width);
+
+void RGB_to_YIQ_row_scalar(int* Y, int* I, int* Q, const uint32_t* src, unsigned int width) {
+	for (unsigned int x = 0; x < width; x++) {
+		const uint32_t p = src[x];
+
+		RGB_to_YIQ(Y[x], I[x], Q[x], (p >> 16U) & 0xFFU, (p >> 8U) & 0xFFU, p & 0xFFU);
+	}
+}
+
+// y, cb and cr are full width here, see YCbCr_to_YIQ_field_row() for subsampled chroma
+using YCbCr_to_YIQ_row_func = void (*)(int* Y, int* I, int* Q, const uint8_t* y, const uint8_t* cb,
+	const uint8_t* cr, const YCbCrToYIQ& m, unsigned int width);
+
+void YCbCr_to_YIQ_row_scalar(int* Y, int* I, int* Q, const uint8_t* y, const uint8_t* cb, const uint8_t* cr,
+	const YCbCrToYIQ& m, unsigned int width) {
+	for (unsigned int x = 0; x < width; x++) {
+		Y[x] = ((m.Yy * y[x]) + (m.Ycb * cb[x]) + (m.Ycr * cr[x]) + m.Y0) >> ycbcr_in_shift;
+		I[x] = ((m.Icb * cb[x]) + (m.Icr * cr[x]) + m.I0) >> ycbcr_in_shift;
+		Q[x] = ((m.Qcb * cb[x]) + (m.Qcr * cr[x]) + m.Q0) >> ycbcr_in_shift;
+	}
+}
+
+void YIQ_to_YCbCr_row_scalar(
+	uint8_t* dY, uint8_t* dCb, uint8_t* dCr, const int* Y, const int* I, const int* Q, unsigned int width) {
+	int y;
+	int cb;
+	int cr;
+
+	for (unsigned int x = 0; x < width; x++) {
+		YIQ_to_YCbCr(y, cb, cr, Y[x], I[x], Q[x]);
+		dY[x]  = y;
+		dCb[x] = cb;
+		dCr[x] = cr;
+	}
+}
+
+// chroma phase noise: rotate the (U, V) vector of every sample by the angle with cosine c and sine s, both
+// fixed point with chroma_rotate_shift fraction bits. rounds toward zero, like the float version did.
+constexpr int chroma_rotate_shift = 12;
+
+using chroma_rotate_row_func = void (*)(int* U, int* V, int c, int s, unsigned int width);
+
+void chroma_rotate_row_scalar(int* U, int* V, const int c, const int s, unsigned int width) {
+	for (unsigned int x = 0; x < width; x++) {
+		const int u = U[x];
+		const int v = V[x];
+
+		U[x] = ((u * c) - (v * s)) / (1 << chroma_rotate_shift);
+		V[x] = ((u * s) + (v * c)) / (1 << chroma_rotate_shift);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// the vector versions do exactly the same integer math as the scalar ones, N pixels at a time,
+// and hand the leftover (width % N) pixels to the scalar version.
+static inline __attribute__((target("sse4.1"))) __m128i RGB_to_YIQ_dot_sse41(
+	__m128i r, __m128i g, __m128i b, int cr, int cg, int cb) {
+	__m128i v = _mm_mullo_epi32(r, _mm_set1_epi32(cr));
+
+	v = _mm_add_epi32(v, _mm_mullo_epi32(g, _mm_set1_epi32(cg)));
+	v = _mm_add_epi32(v, _mm_mullo_epi32(b, _mm_set1_epi32(cb)));
+	v = _mm_add_epi32(v, _mm_and_si128(_mm_srai_epi32(v, 31), _mm_set1_epi32((1 << yiq_in_shift) - 1)));
+	return _mm_srai_epi32(v, yiq_in_shift);
+}
+
+// Y' from Y (i, q = 0) or Cb/Cr from I and Q (v0 = 0), clamped to lo...hi
+static inline __attribute__((target("sse4.1"))) __m128i YIQ_to_YCbCr_dot_sse41(
+	__m128i v0, __m128i i, __m128i q, int ci, int cq, int bias, int lo, int hi) {
+	__m128i v = _mm_add_epi32(v0, _mm_set1_epi32(bias));
+
+	v = _mm_add_epi32(v, _mm_mullo_epi32(i, _mm_set1_epi32(ci)));
+	v = _mm_add_epi32(v, _mm_mullo_epi32(q, _mm_set1_epi32(cq)));
+	v = _mm_srai_epi32(v, yiq_out_shift);
+	return _mm_min_epi32(_mm_max_epi32(v, _mm_set1_epi32(lo)), _mm_set1_epi32(hi));
+}
+
+__attribute__((target("sse4.1"))) void RGB_to_YIQ_row_sse41(
+	int* Y, int* I, int* Q, const uint32_t* src, unsigned int width) {
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	unsigned int  x	= 0;
+
+	for (; (x + 4) <= width; x += 4) {
+		const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+		const __m128i b = _mm_and_si128(p, mask);
+		const __m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), mask);
+		const __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), mask);
+
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(Y + x), RGB_to_YIQ_dot_sse41(r, g, b, yiq_in_Yr, yiq_in_Yg, yiq_in_Yb));
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(I + x), RGB_to_YIQ_dot_sse41(r, g, b, yiq_in_Ir, yiq_in_Ig, yiq_in_Ib));
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(Q + x), RGB_to_YIQ_dot_sse41(r, g, b, yiq_in_Qr, yiq_in_Qg, yiq_in_Qb));
+	}
+
+	RGB_to_YIQ_row_scalar(Y + x, I + x, Q + x, src + x, width - x);
+}
+
+__attribute__((target("sse4.1"))) void YIQ_to_YCbCr_row_sse41(
+	uint8_t* dY, uint8_t* dCb, uint8_t* dCr, const int* Y, const int* I, const int* Q, unsigned int width) {
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int  x	= 0;
+
+	// 8 pixels at a time, two vectors of 4 packed down to 8 bytes per plane
+	for (; (x + 8) <= width; x += 8) {
+		__m128i p[3][2];
+
+		for (unsigned int h = 0; h < 2; h++) {
+			const __m128i sY = _mm_mullo_epi32(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(Y + x + (h * 4))), _mm_set1_epi32(ycbcr_out_Y));
+			const __m128i i = _mm_loadu_si128(reinterpret_cast<const __m128i*>(I + x + (h * 4)));
+			const __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Q + x + (h * 4)));
+
+			p[0][h] = YIQ_to_YCbCr_dot_sse41(sY, zero, zero, 0, 0, ycbcr_out_Y0, 16, 235);
+			p[1][h] = YIQ_to_YCbCr_dot_sse41(zero, i, q, ycbcr_out_bI, ycbcr_out_bQ, ycbcr_out_C0, 16, 240);
+			p[2][h] = YIQ_to_YCbCr_dot_sse41(zero, i, q, ycbcr_out_rI, ycbcr_out_rQ, ycbcr_out_C0, 16, 240);
+		}
+
+		uint8_t* d[3] = {dY + x, dCb + x, dCr + x};
+
+		for (unsigned int c = 0; c < 3; c++) {
+			const __m128i w = _mm_packus_epi32(p[c][0], p[c][1]);
+
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(d[c]), _mm_packus_epi16(w, w));
+		}
+	}
+
+	YIQ_to_YCbCr_row_scalar(dY + x, dCb + x, dCr + x, Y + x, I + x, Q + x, width - x);
+}
+
+// 4 bytes of a Y'CbCr plane, zero extended to int
+static inline __attribute__((target("sse4.1"))) __m128i YCbCr_load_sse41(const uint8_t* p) {
+	int v;
+
+	memcpy(&v, p, sizeof(v));
+	return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v));
+}
+
+static inline __attribute__((target("sse4.1"))) __m128i YCbCr_to_YIQ_dot_sse41(
+	__m128i y, __m128i cb, __m128i cr, int cy, int ccb, int ccr, int bias) {
+	__m128i v = _mm_add_epi32(_mm_mullo_epi32(y, _mm_set1_epi32(cy)), _mm_set1_epi32(bias));
+
+	v = _mm_add_epi32(v, _mm_mullo_epi32(cb, _mm_set1_epi32(ccb)));
+	v = _mm_add_epi32(v, _mm_mullo_epi32(cr, _mm_set1_epi32(ccr)));
+	return _mm_srai_epi32(v, ycbcr_in_shift);
+}
+
+__attribute__((target("sse4.1"))) void YCbCr_to_YIQ_row_sse41(int* Y, int* I, int* Q, const uint8_t* y,
+	const uint8_t* cb, const uint8_t* cr, const YCbCrToYIQ& m, unsigned int width) {
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int  x	= 0;
+
+	for (; (x + 4) <= width; x += 4) {
+		const __m128i vy  = YCbCr_load_sse41(y + x);
+		const __m128i vcb = YCbCr_load_sse41(cb + x);
+		const __m128i vcr = YCbCr_load_sse41(cr + x);
+
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(Y + x), YCbCr_to_YIQ_dot_sse41(vy, vcb, vcr, m.Yy, m.Ycb, m.Ycr, m.Y0));
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(I + x), YCbCr_to_YIQ_dot_sse41(zero, vcb, vcr, 0, m.Icb, m.Icr, m.I0));
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(Q + x), YCbCr_to_YIQ_dot_sse41(zero, vcb, vcr, 0, m.Qcb, m.Qcr, m.Q0));
+	}
+
+	YCbCr_to_YIQ_row_scalar(Y + x, I + x, Q + x, y + x, cb + x, cr + x, m, width - x);
+}
+
+static inline __attribute__((target("avx2"))) __m256i RGB_to_YIQ_dot_avx2(
+	__m256i r, __m256i g, __m256i b, int cr, int cg, int cb) {
+	__m256i v = _mm256_mullo_epi32(r, _mm256_set1_epi32(cr));
 
-	dY = (0.30 * r) + (0.59 * g) + (0.11 * b);
+	v = _mm256_add_epi32(v, _mm256_mullo_epi32(g, _mm256_set1_epi32(cg)));
+	v = _mm256_add_epi32(v, _mm256_mullo_epi32(b, _mm256_set1_epi32(cb)));
+	v = _mm256_add_epi32(v, _mm256_and_si256(_mm256_srai_epi32(v, 31), _mm256_set1_epi32((1 << yiq_in_shift) - 1)));
+	return _mm256_srai_epi32(v, yiq_in_shift);
+}
+
+static inline __attribute__((target("avx2"))) __m256i YIQ_to_YCbCr_dot_avx2(
+	__m256i v0, __m256i i, __m256i q, int ci, int cq, int bias, int lo, int hi) {
+	__m256i v = _mm256_add_epi32(v0, _mm256_set1_epi32(bias));
+
+	v = _mm256_add_epi32(v, _mm256_mullo_epi32(i, _mm256_set1_epi32(ci)));
+	v = _mm256_add_epi32(v, _mm256_mullo_epi32(q, _mm256_set1_epi32(cq)));
+	v = _mm256_srai_epi32(v, yiq_out_shift);
+	return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_set1_epi32(lo)), _mm256_set1_epi32(hi));
+}
+
+__attribute__((target("avx2"))) void RGB_to_YIQ_row_avx2(
+	int* Y, int* I, int* Q, const uint32_t* src, unsigned int width) {
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	unsigned int  x	= 0;
+
+	for (; (x + 8) <= width; x += 8) {
+		const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x));
+		const __m256i b = _mm256_and_si256(p, mask);
+		const __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 8), mask);
+		const __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 16), mask);
+
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(Y + x), RGB_to_YIQ_dot_avx2(r, g, b, yiq_in_Yr, yiq_in_Yg, yiq_in_Yb));
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(I + x), RGB_to_YIQ_dot_avx2(r, g, b, yiq_in_Ir, yiq_in_Ig, yiq_in_Ib));
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(Q + x), RGB_to_YIQ_dot_avx2(r, g, b, yiq_in_Qr, yiq_in_Qg, yiq_in_Qb));
+	}
+
+	RGB_to_YIQ_row_scalar(Y + x, I + x, Q + x, src + x, width - x);
+}
+
+__attribute__((target("avx2"))) void YIQ_to_YCbCr_row_avx2(
+	uint8_t* dY, uint8_t* dCb, uint8_t* dCr, const int* Y, const int* I, const int* Q, unsigned int width) {
+	const __m256i zero = _mm256_setzero_si256();
+	// the low byte of each 32-bit lane to the bottom of its 128-bit half, then the two halves together
+	const __m256i bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i halves = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+	unsigned int  x		 = 0;
+
+	for (; (x + 8) <= width; x += 8) {
+		const __m256i sY = _mm256_mullo_epi32(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Y + x)), _mm256_set1_epi32(ycbcr_out_Y));
+		const __m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(I + x));
+		const __m256i q = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Q + x));
+		const __m256i p[3] = {YIQ_to_YCbCr_dot_avx2(sY, zero, zero, 0, 0, ycbcr_out_Y0, 16, 235),
+			YIQ_to_YCbCr_dot_avx2(zero, i, q, ycbcr_out_bI, ycbcr_out_bQ, ycbcr_out_C0, 16, 240),
+			YIQ_to_YCbCr_dot_avx2(zero, i, q, ycbcr_out_rI, ycbcr_out_rQ, ycbcr_out_C0, 16, 240)};
+		uint8_t* d[3] = {dY + x, dCb + x, dCr + x};
+
+		for (unsigned int c = 0; c < 3; c++) {
+			const __m256i b = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(p[c], bytes), halves);
+
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(d[c]), _mm256_castsi256_si128(b));
+		}
+	}
+
+	YIQ_to_YCbCr_row_scalar(dY + x, dCb + x, dCr + x, Y + x, I + x, Q + x, width - x);
+}
+
+static inline __attribute__((target("avx2"))) __m256i YCbCr_load_avx2(const uint8_t* p) {
+	return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+}
+
+static inline __attribute__((target("avx2"))) __m256i YCbCr_to_YIQ_dot_avx2(
+	__m256i y, __m256i cb, __m256i cr, int cy, int ccb, int ccr, int bias) {
+	__m256i v = _mm256_add_epi32(_mm256_mullo_epi32(y, _mm256_set1_epi32(cy)), _mm256_set1_epi32(bias));
+
+	v = _mm256_add_epi32(v, _mm256_mullo_epi32(cb, _mm256_set1_epi32(ccb)));
+	v = _mm256_add_epi32(v, _mm256_mullo_epi32(cr, _mm256_set1_epi32(ccr)));
+	return _mm256_srai_epi32(v, ycbcr_in_shift);
+}
+
+__attribute__((target("avx2"))) void YCbCr_to_YIQ_row_avx2(int* Y, int* I, int* Q, const uint8_t* y,
+	const uint8_t* cb, const uint8_t* cr, const YCbCrToYIQ& m, unsigned int width) {
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned int  x	= 0;
+
+	for (; (x + 8) <= width; x += 8) {
+		const __m256i vy  = YCbCr_load_avx2(y + x);
+		const __m256i vcb = YCbCr_load_avx2(cb + x);
+		const __m256i vcr = YCbCr_load_avx2(cr + x);
+
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(Y + x), YCbCr_to_YIQ_dot_avx2(vy, vcb, vcr, m.Yy, m.Ycb, m.Ycr, m.Y0));
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(I + x), YCbCr_to_YIQ_dot_avx2(zero, vcb, vcr, 0, m.Icb, m.Icr, m.I0));
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(Q + x), YCbCr_to_YIQ_dot_avx2(zero, vcb, vcr, 0, m.Qcb, m.Qcr, m.Q0));
+	}
+
+	YCbCr_to_YIQ_row_scalar(Y + x, I + x, Q + x, y + x, cb + x, cr + x, m, width - x);
+}
+
+static inline __attribute__((target("avx512f"))) __m512i RGB_to_YIQ_dot_avx512(
+	__m512i r, __m512i g, __m512i b, int cr, int cg, int cb) {
+	__m512i v = _mm512_mullo_epi32(r, _mm512_set1_epi32(cr));
+
+	v = _mm512_add_epi32(v, _mm512_mullo_epi32(g, _mm512_set1_epi32(cg)));
+	v = _mm512_add_epi32(v, _mm512_mullo_epi32(b, _mm512_set1_epi32(cb)));
+	v = _mm512_add_epi32(v, _mm512_and_si512(_mm512_srai_epi32(v, 31), _mm512_set1_epi32((1 << yiq_in_shift) - 1)));
+	return _mm512_srai_epi32(v, yiq_in_shift);
+}
+
+static inline __attribute__((target("avx512f"))) __m512i YIQ_to_YCbCr_dot_avx512(
+	__m512i v0, __m512i i, __m512i q, int ci, int cq, int bias, int lo, int hi) {
+	__m512i v = _mm512_add_epi32(v0, _mm512_set1_epi32(bias));
+
+	v = _mm512_add_epi32(v, _mm512_mullo_epi32(i, _mm512_set1_epi32(ci)));
+	v = _mm512_add_epi32(v, _mm512_mullo_epi32(q, _mm512_set1_epi32(cq)));
+	v = _mm512_srai_epi32(v, yiq_out_shift);
+	return _mm512_min_epi32(_mm512_max_epi32(v, _mm512_set1_epi32(lo)), _mm512_set1_epi32(hi));
+}
+
+__attribute__((target("avx512f"))) void RGB_to_YIQ_row_avx512(
+	int* Y, int* I, int* Q, const uint32_t* src, unsigned int width) {
+	const __m512i mask = _mm512_set1_epi32(0xFF);
+	unsigned int  x	= 0;
+
+	for (; (x + 16) <= width; x += 16) {
+		const __m512i p = _mm512_loadu_si512(src + x);
+		const __m512i b = _mm512_and_si512(p, mask);
+		const __m512i g = _mm512_and_si512(_mm512_srli_epi32(p, 8), mask);
+		const __m512i r = _mm512_and_si512(_mm512_srli_epi32(p, 16), mask);
+
+		_mm512_storeu_si512(Y + x, RGB_to_YIQ_dot_avx512(r, g, b, yiq_in_Yr, yiq_in_Yg, yiq_in_Yb));
+		_mm512_storeu_si512(I + x, RGB_to_YIQ_dot_avx512(r, g, b, yiq_in_Ir, yiq_in_Ig, yiq_in_Ib));
+		_mm512_storeu_si512(Q + x, RGB_to_YIQ_dot_avx512(r, g, b, yiq_in_Qr, yiq_in_Qg, yiq_in_Qb));
+	}
+
+	RGB_to_YIQ_row_scalar(Y + x, I + x, Q + x, src + x, width - x);
+}
+
+__attribute__((target("avx512f"))) void YIQ_to_YCbCr_row_avx512(
+	uint8_t* dY, uint8_t* dCb, uint8_t* dCr, const int* Y, const int* I, const int* Q, unsigned int width) {
+	const __m512i zero = _mm512_setzero_si512();
+	unsigned int  x	= 0;
+
+	for (; (x + 16) <= width; x += 16) {
+		const __m512i sY = _mm512_mullo_epi32(_mm512_loadu_si512(Y + x), _mm512_set1_epi32(ycbcr_out_Y));
+		const __m512i i  = _mm512_loadu_si512(I + x);
+		const __m512i q  = _mm512_loadu_si512(Q + x);
+
+		const __m512i y  = YIQ_to_YCbCr_dot_avx512(sY, zero, zero, 0, 0, ycbcr_out_Y0, 16, 235);
+		const __m512i cb = YIQ_to_YCbCr_dot_avx512(zero, i, q, ycbcr_out_bI, ycbcr_out_bQ, ycbcr_out_C0, 16, 240);
+		const __m512i cr = YIQ_to_YCbCr_dot_avx512(zero, i, q, ycbcr_out_rI, ycbcr_out_rQ, ycbcr_out_C0, 16, 240);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dY + x), _mm512_cvtepi32_epi8(y));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dCb + x), _mm512_cvtepi32_epi8(cb));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dCr + x), _mm512_cvtepi32_epi8(cr));
+	}
+
+	YIQ_to_YCbCr_row_scalar(dY + x, dCb + x, dCr + x, Y + x, I + x, Q + x, width - x);
+}
+
+static inline __attribute__((target("avx512f"))) __m512i YCbCr_load_avx512(const uint8_t* p) {
+	return _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+static inline __attribute__((target("avx512f"))) __m512i YCbCr_to_YIQ_dot_avx512(
+	__m512i y, __m512i cb, __m512i cr, int cy, int ccb, int ccr, int bias) {
+	__m512i v = _mm512_add_epi32(_mm512_mullo_epi32(y, _mm512_set1_epi32(cy)), _mm512_set1_epi32(bias));
+
+	v = _mm512_add_epi32(v, _mm512_mullo_epi32(cb, _mm512_set1_epi32(ccb)));
+	v = _mm512_add_epi32(v, _mm512_mullo_epi32(cr, _mm512_set1_epi32(ccr)));
+	return _mm512_srai_epi32(v, ycbcr_in_shift);
+}
+
+__attribute__((target("avx512f"))) void YCbCr_to_YIQ_row_avx512(int* Y, int* I, int* Q, const uint8_t* y,
+	const uint8_t* cb, const uint8_t* cr, const YCbCrToYIQ& m, unsigned int width) {
+	const __m512i zero = _mm512_setzero_si512();
+	unsigned int  x	= 0;
+
+	for (; (x + 16) <= width; x += 16) {
+		const __m512i vy  = YCbCr_load_avx512(y + x);
+		const __m512i vcb = YCbCr_load_avx512(cb + x);
+		const __m512i vcr = YCbCr_load_avx512(cr + x);
+
+		_mm512_storeu_si512(Y + x, YCbCr_to_YIQ_dot_avx512(vy, vcb, vcr, m.Yy, m.Ycb, m.Ycr, m.Y0));
+		_mm512_storeu_si512(I + x, YCbCr_to_YIQ_dot_avx512(zero, vcb, vcr, 0, m.Icb, m.Icr, m.I0));
+		_mm512_storeu_si512(Q + x, YCbCr_to_YIQ_dot_avx512(zero, vcb, vcr, 0, m.Qcb, m.Qcr, m.Q0));
+	}
+
+	YCbCr_to_YIQ_row_scalar(Y + x, I + x, Q + x, y + x, cb + x, cr + x, m, width - x);
+}
+
+// division by 1 << chroma_rotate_shift, toward zero
+static inline __attribute__((target("sse4.1"))) __m128i chroma_rotate_div_sse41(__m128i v) {
+	const __m128i round = _mm_set1_epi32((1 << chroma_rotate_shift) - 1);
+
+	v = _mm_add_epi32(v, _mm_and_si128(_mm_srai_epi32(v, 31), round));
+	return _mm_srai_epi32(v, chroma_rotate_shift);
+}
+
+__attribute__((target("sse4.1"))) void chroma_rotate_row_sse41(
+	int* U, int* V, const int c, const int s, unsigned int width) {
+	const __m128i vc = _mm_set1_epi32(c);
+	const __m128i vs = _mm_set1_epi32(s);
+	unsigned int  x  = 0;
+
+	for (; (x + 4) <= width; x += 4) {
+		const __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(U + x));
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(V + x));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(U + x),
+			chroma_rotate_div_sse41(_mm_sub_epi32(_mm_mullo_epi32(u, vc), _mm_mullo_epi32(v, vs))));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(V + x),
+			chroma_rotate_div_sse41(_mm_add_epi32(_mm_mullo_epi32(u, vs), _mm_mullo_epi32(v, vc))));
+	}
+
+	chroma_rotate_row_scalar(U + x, V + x, c, s, width - x);
+}
+
+static inline __attribute__((target("avx2"))) __m256i chroma_rotate_div_avx2(__m256i v) {
+	const __m256i round = _mm256_set1_epi32((1 << chroma_rotate_shift) - 1);
+
+	v = _mm256_add_epi32(v, _mm256_and_si256(_mm256_srai_epi32(v, 31), round));
+	return _mm256_srai_epi32(v, chroma_rotate_shift);
+}
+
+__attribute__((target("avx2"))) void chroma_rotate_row_avx2(
+	int* U, int* V, const int c, const int s, unsigned int width) {
+	const __m256i vc = _mm256_set1_epi32(c);
+	const __m256i vs = _mm256_set1_epi32(s);
+	unsigned int  x  = 0;
+
+	for (; (x + 8) <= width; x += 8) {
+		const __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(U + x));
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(V + x));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(U + x),
+			chroma_rotate_div_avx2(_mm256_sub_epi32(_mm256_mullo_epi32(u, vc), _mm256_mullo_epi32(v, vs))));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(V + x),
+			chroma_rotate_div_avx2(_mm256_add_epi32(_mm256_mullo_epi32(u, vs), _mm256_mullo_epi32(v, vc))));
+	}
+
+	chroma_rotate_row_scalar(U + x, V + x, c, s, width - x);
+}
+
+static inline __attribute__((target("avx512f"))) __m512i chroma_rotate_div_avx512(__m512i v) {
+	const __m512i round = _mm512_set1_epi32((1 << chroma_rotate_shift) - 1);
+
+	v = _mm512_add_epi32(v, _mm512_and_si512(_mm512_srai_epi32(v, 31), round));
+	return _mm512_srai_epi32(v, chroma_rotate_shift);
+}
+
+__attribute__((target("avx512f"))) void chroma_rotate_row_avx512(
+	int* U, int* V, const int c, const int s, unsigned int width) {
+	const __m512i vc = _mm512_set1_epi32(c);
+	const __m512i vs = _mm512_set1_epi32(s);
+	unsigned int  x  = 0;
+
+	for (; (x + 16) <= width; x += 16) {
+		const __m512i u = _mm512_loadu_si512(U + x);
+		const __m512i v = _mm512_loadu_si512(V + x);
+
+		_mm512_storeu_si512(
+			U + x, chroma_rotate_div_avx512(_mm512_sub_epi32(_mm512_mullo_epi32(u, vc), _mm512_mullo_epi32(v, vs))));
+		_mm512_storeu_si512(
+			V + x, chroma_rotate_div_avx512(_mm512_add_epi32(_mm512_mullo_epi32(u, vs), _mm512_mullo_epi32(v, vc))));
+	}
+
+	chroma_rotate_row_scalar(U + x, V + x, c, s, width - x);
+}
+#endif
+
+// a scanline filter: a cascade of identical LowpassFilter stages, plus what the composite/VHS stages do with
+// the result. every stage of composite_layer() that runs LowpassFilters along a scanline is one of these:
+//
+//   LOWPASS:   out[x - delay] = lowpass^stages(in[x])                      (x >= delay, the rest is left alone)
+//   HIGHBOOST: s = lowpass^stages(in[x]); out[x] = s + (highpass(s) * gain)  (preemphasis, VHS luma)
+//   SHARPEN:   out[x] = in[x] + ((in[x] - lowpass^stages(in[x])) * gain)     (VHS playback sharpening)
+//
+// the recursion makes a single scanline impossible to vectorize, but the scanlines of a field are independent,
+// so ScanlineIIR_rows runs a batch of them in lockstep, one scanline per SIMD lane.
+class ScanlineIIR
+{
+public:
+	enum
+	{
+		LOWPASS = 0,
+		HIGHBOOST,
+		SHARPEN
+	};
+
+	static constexpr unsigned int max_stages = 3;
+
+public:
+	void setLowpass(
+		const float rate, const float hz, const unsigned int _stages, const float _reset, const int _delay) {
+		LowpassFilter f;
+
+		f.setFilter(rate, hz);
+		mode   = LOWPASS;
+		alpha  = f.alpha;
+		stages = std::min(_stages, max_stages);
+		reset  = _reset;
+		delay  = _delay;
+	}
+	void setHighboost(const float rate, const float hz, const float _reset, const float _gain) {
+		LowpassFilter f;
+
+		f.setFilter(rate, hz);
+		mode		= HIGHBOOST;
+		boost_alpha = f.alpha;
+		boost_reset = _reset;
+		gain		= _gain;
+		delay		= 0;
+	}
+	void setSharpen(const float _gain) {
+		mode  = SHARPEN;
+		gain  = _gain;
+		delay = 0;
+	}
+
+public:
+	int			 mode{LOWPASS};
+	unsigned int stages{0};
+	float		 alpha{0};
+	float		 reset{0};
+	int			 delay{0};
+	float		 boost_alpha{0};
+	float		 boost_reset{0};
+	float		 gain{0};
+};
+
+// the rows are samples of working format T. the filter state starts at reset, which is given at int scale.
+template <typename T>
+using ScanlineIIR_rows_func = void (*)(const ScanlineIIR& f, T* const* rows, unsigned int count, unsigned int width);
+
+// reference version, literally the per-scanline LowpassFilter loops the stages used to have
+template <typename T>
+void ScanlineIIR_rows_scalar(const ScanlineIIR& f, T* const* rows, unsigned int count, unsigned int width) {
+	constexpr int scale = 1 << WorkFormat<T>::shift;
+
+	for (unsigned int r = 0; r < count; r++) {
+		T*			  P = rows[r];
+		LowpassFilter lp[ScanlineIIR::max_stages];
+		LowpassFilter pre;
+		float		  s;
+		float		  ts;
+
+		for (unsigned int i = 0; i < f.stages; i++) {
+			lp[i].alpha = f.alpha;
+			lp[i].resetFilter(f.reset / scale);
+		}
+		pre.alpha = f.boost_alpha;
+		pre.resetFilter(f.boost_reset / scale);
+
+		for (unsigned int x = 0; x < width; x++) {
+			s = ts = P[x];
+			for (unsigned int i = 0; i < f.stages; i++) { ts = lp[i].lowpass(ts); }
+
+			if (f.mode == ScanlineIIR::HIGHBOOST) {
+				P[x] = WorkFormat<T>::fclamp(ts + (pre.highpass(ts) * f.gain));
+			} else if (f.mode == ScanlineIIR::SHARPEN) {
+				P[x] = WorkFormat<T>::fclamp(s + ((s - ts) * f.gain));
+			} else if (x >= f.delay) {
+				P[x - f.delay] = WorkFormat<T>::fclamp(ts);
+			}
+		}
+	}
+}
+
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int	  v4si __attribute__((vector_size(16)));
+typedef float v8sf __attribute__((vector_size(32)));
+typedef int	  v8si __attribute__((vector_size(32)));
+typedef float v16sf __attribute__((vector_size(64)));
+typedef int	  v16si __attribute__((vector_size(64)));
+
+// SIMD version, one scanline per lane. the scanlines are transposed in and out in tiles of tile_width samples so
+// that the recursion itself only touches whole vectors. the arithmetic is the same as LowpassFilter::lowpass()
+// and highpass(), operation for operation, so each lane produces the same output as the scalar version.
+template <typename T, typename vf, typename vi, unsigned int lanes, int mode>
+static inline __attribute__((always_inline)) void ScanlineIIR_rows_kernel(
+	const ScanlineIIR& f, T* const* rows, unsigned int count, unsigned int width) {
+	constexpr unsigned int tile_width = 64;
+	constexpr int		   scale	  = 1 << WorkFormat<T>::shift;
+	vi					   tile[tile_width];
+	vf					   prev[ScanlineIIR::max_stages];
+	vf					   boost_prev = vf{} + (f.boost_reset / scale);
+	const vf			   alpha	  = vf{} + f.alpha;
+	const vf			   boost	  = vf{} + f.boost_alpha;
+	const vf			   gain		  = vf{} + f.gain;
+
+	for (unsigned int i = 0; i < f.stages; i++) { prev[i] = vf{} + (f.reset / scale); }
+	memset(tile, 0, sizeof(tile));  // unused lanes stay zero
+
+	for (unsigned int x0 = 0; x0 < width; x0 += tile_width) {
+		const unsigned int n = std::min(tile_width, width - x0);
+
+		for (unsigned int l = 0; l < count; l++) {
+			const T* P = rows[l] + x0;
+			for (unsigned int j = 0; j < n; j++) { tile[j][l] = P[j]; }
+		}
+
+		for (unsigned int j = 0; j < n; j++) {
+			const vf s  = __builtin_convertvector(tile[j], vf);
+			vf		 ts = s;
+
+			for (unsigned int i = 0; i < f.stages; i++) {
+				const vf stage1 = ts * alpha;
+				const vf stage2 = prev[i] - (prev[i] * alpha);
+				ts = prev[i] = stage1 + stage2;
+			}
+
+			if (mode == ScanlineIIR::HIGHBOOST) {
+				const vf stage1 = ts * boost;
+				const vf stage2 = boost_prev - (boost_prev * boost);
+				boost_prev		= stage1 + stage2;
+				ts				= ts + ((ts - boost_prev) * gain);
+			} else if (mode == ScanlineIIR::SHARPEN) {
+				ts = s + ((s - ts) * gain);
+			}
+
+			if (WorkFormat<T>::shift != 0) {
+				ts = (ts < -32768.F) ? (vf{} - 32768.F) : ts;  // saturate to int16
+				ts = (ts > 32767.F) ? (vf{} + 32767.F) : ts;
+			}
+
+			tile[j] = __builtin_convertvector(ts, vi);
+		}
+
+		// LOWPASS writes each result delay samples back. those samples were already read (this tile or an
+		// earlier one), same as the scalar loop which reads P[x] after writing P[x - delay].
+		const unsigned int d  = (mode == ScanlineIIR::LOWPASS) ? f.delay : 0;
+		const unsigned int j0 = (x0 >= d) ? 0 : (d - x0);
+
+		for (unsigned int l = 0; l < count; l++) {
+			T* P = rows[l] + x0 - d;
+			for (unsigned int j = j0; j < n; j++) { P[j] = tile[j][l]; }
+		}
+	}
+}
+
+template <typename T, typename vf, typename vi, unsigned int lanes>
+static inline __attribute__((always_inline)) void ScanlineIIR_rows_simd(
+	const ScanlineIIR& f, T* const* rows, unsigned int count, unsigned int width) {
+	switch (f.mode) {
+		case ScanlineIIR::HIGHBOOST:
+			ScanlineIIR_rows_kernel<T, vf, vi, lanes, ScanlineIIR::HIGHBOOST>(f, rows, count, width);
+			break;
+		case ScanlineIIR::SHARPEN:
+			ScanlineIIR_rows_kernel<T, vf, vi, lanes, ScanlineIIR::SHARPEN>(f, rows, count, width);
+			break;
+		default: ScanlineIIR_rows_kernel<T, vf, vi, lanes, ScanlineIIR::LOWPASS>(f, rows, count, width); break;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <typename T>
+__attribute__((target("sse4.1"))) void ScanlineIIR_rows_sse41(
+	const ScanlineIIR& f, T* const* rows, unsigned int count, unsigned int width) {
+	ScanlineIIR_rows_simd<T, v4sf, v4si, 4>(f, rows, count, width);
+}
+
+template <typename T>
+__attribute__((target("avx2"))) void ScanlineIIR_rows_avx2(
+	const ScanlineIIR& f, T* const* rows, unsigned int count, unsigned int width) {
+	ScanlineIIR_rows_simd<T, v8sf, v8si, 8>(f, rows, count, width);
+}
+
+template <typename T>
+__attribute__((target("avx512f"))) void ScanlineIIR_rows_avx512(
+	const ScanlineIIR& f, T* const* rows, unsigned int count, unsigned int width) {
+	ScanlineIIR_rows_simd<T, v16sf, v16si, 16>(f, rows, count, width);
+}
+#endif
+
+RGB_to_YIQ_row_func			   RGB_to_YIQ_row	= RGB_to_YIQ_row_scalar;
+YCbCr_to_YIQ_row_func		   YCbCr_to_YIQ_row   = YCbCr_to_YIQ_row_scalar;
+YIQ_to_YCbCr_row_func		   YIQ_to_YCbCr_row   = YIQ_to_YCbCr_row_scalar;
+chroma_rotate_row_func		   chroma_rotate_row  = chroma_rotate_row_scalar;
+ScanlineIIR_rows_func<int>	   ScanlineIIR_rows   = ScanlineIIR_rows_scalar<int>;
+ScanlineIIR_rows_func<int16_t> ScanlineIIR_rows16 = ScanlineIIR_rows_scalar<int16_t>;
+unsigned int				   ScanlineIIR_lanes  = 1;  // scanlines per ScanlineIIR_rows() call
+
+// highest SIMD level the CPU supports
+static int simd_cpu_level() {
+	int level = SIMD_NONE;
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		level = SIMD_AVX512;
+	} else if (__builtin_cpu_supports("avx2")) {
+		level = SIMD_AVX2;
+	} else if (__builtin_cpu_supports("sse4.1")) {
+		level = SIMD_SSE41;
+	}
+#endif
 
-	Y = static_cast<int>(256 * dY);
-	I = static_cast<int>(256 * ((-0.27 * (b - dY)) + (0.74 * (r - dY))));
-	Q = static_cast<int>(256 * ((0.41 * (b - dY)) + (0.48 * (r - dY))));
+	return level;
+}
+
+// pick the scanline kernels once at startup, from what the CPU supports (and -simd, if given)
+void select_simd_kernels() {
+	int level = simd_cpu_level();
+
+	if (video_simd != SIMD_AUTO && video_simd < level) { level = video_simd; }
+
+	switch (level) {
+#if defined(__x86_64__) || defined(__i386__)
+		case SIMD_AVX512:
+			RGB_to_YIQ_row	   = RGB_to_YIQ_row_avx512;
+			YCbCr_to_YIQ_row   = YCbCr_to_YIQ_row_avx512;
+			YIQ_to_YCbCr_row   = YIQ_to_YCbCr_row_avx512;
+			chroma_rotate_row  = chroma_rotate_row_avx512;
+			ScanlineIIR_rows	  = ScanlineIIR_rows_avx512<int>;
+			ScanlineIIR_rows16 = ScanlineIIR_rows_avx512<int16_t>;
+			ScanlineIIR_lanes  = 16;
+			fprintf(stderr, "Using AVX-512 scanline kernels\n");
+			break;
+		case SIMD_AVX2:
+			RGB_to_YIQ_row	   = RGB_to_YIQ_row_avx2;
+			YCbCr_to_YIQ_row   = YCbCr_to_YIQ_row_avx2;
+			YIQ_to_YCbCr_row   = YIQ_to_YCbCr_row_avx2;
+			chroma_rotate_row  = chroma_rotate_row_avx2;
+			ScanlineIIR_rows	  = ScanlineIIR_rows_avx2<int>;
+			ScanlineIIR_rows16 = ScanlineIIR_rows_avx2<int16_t>;
+			ScanlineIIR_lanes  = 8;
+			fprintf(stderr, "Using AVX2 scanline kernels\n");
+			break;
+		case SIMD_SSE41:
+			RGB_to_YIQ_row	   = RGB_to_YIQ_row_sse41;
+			YCbCr_to_YIQ_row   = YCbCr_to_YIQ_row_sse41;
+			YIQ_to_YCbCr_row   = YIQ_to_YCbCr_row_sse41;
+			chroma_rotate_row  = chroma_rotate_row_sse41;
+			ScanlineIIR_rows	  = ScanlineIIR_rows_sse41<int>;
+			ScanlineIIR_rows16 = ScanlineIIR_rows_sse41<int16_t>;
+			ScanlineIIR_lanes  = 4;
+			fprintf(stderr, "Using SSE4.1 scanline kernels\n");
+			break;
+#endif
+		default:
+			RGB_to_YIQ_row	   = RGB_to_YIQ_row_scalar;
+			YCbCr_to_YIQ_row   = YCbCr_to_YIQ_row_scalar;
+			YIQ_to_YCbCr_row   = YIQ_to_YCbCr_row_scalar;
+			chroma_rotate_row  = chroma_rotate_row_scalar;
+			ScanlineIIR_rows	  = ScanlineIIR_rows_scalar<int>;
+			ScanlineIIR_rows16 = ScanlineIIR_rows_scalar<int16_t>;
+			ScanlineIIR_lanes  = 1;
+			fprintf(stderr, "Using scalar scanline kernels\n");
+			break;
+	}
+}
+
+// the int16 working format goes through the int converters 256 pixels at a time, at the int16 scale
+void RGB_to_YIQ_row16(int16_t* Y, int16_t* I, int16_t* Q, const uint32_t* src, unsigned int width) {
+	constexpr int shift = WorkFormat<int16_t>::shift;
+	int			  tY[256];
+	int			  tI[256];
+	int			  tQ[256];
+
+	for (unsigned int x0 = 0; x0 < width; x0 += 256) {
+		const unsigned int n = std::min(256U, width - x0);
+
+		RGB_to_YIQ_row(tY, tI, tQ, src + x0, n);
+		for (unsigned int x = 0; x < n; x++) {
+			Y[x0 + x] = WorkFormat<int16_t>::clamp(tY[x] >> shift);
+			I[x0 + x] = WorkFormat<int16_t>::clamp(tI[x] >> shift);
+			Q[x0 + x] = WorkFormat<int16_t>::clamp(tQ[x] >> shift);
+		}
+	}
+}
+
+void YIQ_to_YCbCr_row16(
+	uint8_t* dY, uint8_t* dCb, uint8_t* dCr, const int16_t* Y, const int16_t* I, const int16_t* Q, unsigned int width) {
+	constexpr int scale = 1 << WorkFormat<int16_t>::shift;
+	int			  tY[256];
+	int			  tI[256];
+	int			  tQ[256];
+
+	for (unsigned int x0 = 0; x0 < width; x0 += 256) {
+		const unsigned int n = std::min(256U, width - x0);
+
+		for (unsigned int x = 0; x < n; x++) {
+			tY[x] = Y[x0 + x] * scale;
+			tI[x] = I[x0 + x] * scale;
+			tQ[x] = Q[x0 + x] * scale;
+		}
+		YIQ_to_YCbCr_row(dY + x0, dCb + x0, dCr + x0, tY, tI, tQ, n);
+	}
+}
+
+void chroma_rotate_row16(int16_t* U, int16_t* V, const int c, const int s, unsigned int width) {
+	int tU[256];
+	int tV[256];
+
+	for (unsigned int x0 = 0; x0 < width; x0 += 256) {
+		const unsigned int n = std::min(256U, width - x0);
+
+		for (unsigned int x = 0; x < n; x++) {
+			tU[x] = U[x0 + x];
+			tV[x] = V[x0 + x];
+		}
+		chroma_rotate_row(tU, tV, c, s, n);
+		for (unsigned int x = 0; x < n; x++) {
+			U[x0 + x] = WorkFormat<int16_t>::clamp(tU[x]);
+			V[x0 + x] = WorkFormat<int16_t>::clamp(tV[x]);
+		}
+	}
+}
+
+// the kernels for the working format of a FieldPlane<T>
+static inline void RGB_to_YIQ_field_row(int* Y, int* I, int* Q, const uint32_t* src, unsigned int width) {
+	RGB_to_YIQ_row(Y, I, Q, src, width);
+}
+
+static inline void RGB_to_YIQ_field_row(int16_t* Y, int16_t* I, int16_t* Q, const uint32_t* src, unsigned int width) {
+	RGB_to_YIQ_row16(Y, I, Q, src, width);
+}
+
+static inline void YIQ_to_YCbCr_field_row(
+	uint8_t* dY, uint8_t* dCb, uint8_t* dCr, const int* Y, const int* I, const int* Q, unsigned int width) {
+	YIQ_to_YCbCr_row(dY, dCb, dCr, Y, I, Q, width);
+}
+
+static inline void YIQ_to_YCbCr_field_row(
+	uint8_t* dY, uint8_t* dCb, uint8_t* dCr, const int16_t* Y, const int16_t* I, const int16_t* Q, unsigned int width) {
+	YIQ_to_YCbCr_row16(dY, dCb, dCr, Y, I, Q, width);
+}
+
+static inline void chroma_rotate_field_row(int* U, int* V, const int c, const int s, unsigned int width) {
+	chroma_rotate_row(U, V, c, s, width);
+}
+
+static inline void chroma_rotate_field_row(int16_t* U, int16_t* V, const int c, const int s, unsigned int width) {
+	chroma_rotate_row16(U, V, c, s, width);
+}
+
+// -test-kernels: run every SIMD level the CPU has against the scalar kernels, on random rows and on rows of edge
+// values, at widths that leave every possible tail. the scalar kernels are checked against the double precision
+// formulas they stand in for. every output must be within 1 LSB of its reference.
+class KernelTest
+{
+public:
+	static constexpr unsigned int width = 1021;  // not a multiple of any vector width, nor of the int16 batches
+	static constexpr unsigned int rows	= 64;
+
+public:
+	// the width of row r: the full one, less 0...16, so that the leftover pixels come in every count
+	static unsigned int row_width(const unsigned int r) { return width - (r % 17U); }
+
+	// the deviation of a whole set of outputs, in LSBs of the given size
+	class Check
+	{
+	public:
+		Check(const char* _level, const char* _what, const double _lsb = 1) : level(_level), what(_what), lsb(_lsb) {}
+
+		void compare(const double got, const double want) { maxdev = std::max(maxdev, fabs(got - want) / lsb); }
+		bool report() const {
+			fprintf(stderr, "%-8s %-34s max %.3f LSB%s\n", level, what, maxdev, maxdev > 1.0 ? "  FAILED" : "");
+			return maxdev <= 1.0;
+		}
+
+	private:
+		const char* level;
+		const char* what;
+		double		lsb;
+		double		maxdev{0};
+	};
+
+public:
+	KernelTest() {
+		const int	  edge8[] = {0, 1, 16, 127, 128, 235, 240, 254, 255};
+		const int	  edgeY[] = {-10000, -1, 0, 16 << 8, 235 << 8, 255 << 8, 80000};
+		const int	  edgeC[] = {-60000, -32768, -1, 0, 1, 32767, 60000};
+		unsigned int  e;
+		unsigned int  i;
+		unsigned int  n		= rows * width;
+		std::vector<uint32_t> rnd(n * 3);
+
+		for (unsigned int y = 0; y < rows; y++) { noise_fill(&rnd[y * width * 3], width * 3, NOISE_KERNEL_TEST, 0, y); }
+
+		bgra.resize(n);
+		yc[0].resize(n);
+		yc[1].resize(n);
+		yc[2].resize(n);
+		Y.resize(n);
+		I.resize(n);
+		Q.resize(n);
+		for (i = 0; i < n; i++) {
+			bgra[i]	 = rnd[i * 3];
+			yc[0][i] = static_cast<uint8_t>(rnd[(i * 3) + 1]);
+			yc[1][i] = static_cast<uint8_t>(rnd[(i * 3) + 1] >> 8U);
+			yc[2][i] = static_cast<uint8_t>(rnd[(i * 3) + 1] >> 16U);
+			Y[i]	 = static_cast<int>(rnd[(i * 3) + 2] % 90001U) - 10000;			  // luma -10000...80000
+			I[i]	 = static_cast<int>((rnd[(i * 3) + 2] >> 8U) % 120001U) - 60000;  // chroma +/- 60000
+			Q[i]	 = static_cast<int>((rnd[(i * 3) + 1] >> 24U) * 471U) - 60000;
+		}
+
+		// the first row: every combination of the edge values (alpha too, which is ignored)
+		e = 0;
+		for (const int a : {0, 255}) {
+			for (const int r : edge8) {
+				for (const int g : edge8) {
+					for (const int b : edge8) {
+						bgra[e]	 = (a << 24) | (r << 16) | (g << 8) | b;
+						yc[0][e] = static_cast<uint8_t>(r);
+						yc[1][e] = static_cast<uint8_t>(g);
+						yc[2][e] = static_cast<uint8_t>(b);
+						e++;
+					}
+				}
+			}
+		}
+		e = 0;
+		for (const int y : edgeY) {
+			for (const int ci : edgeC) {
+				for (const int cq : edgeC) {
+					Y[e] = y;
+					I[e] = ci;
+					Q[e] = cq;
+					e++;
+				}
+			}
+		}
+	}
+
+public:
+	std::vector<uint32_t> bgra;
+	std::vector<uint8_t>  yc[3];  // Y', Cb, Cr
+	std::vector<int>	  Y, I, Q;
+};
+
+static double kernel_test_round(const double v) { return floor(v + 0.5); }
+
+// the scalar kernels against the double precision formulas
+static bool test_scalar_kernels(const KernelTest& t) {
+	KernelTest::Check rgb("scalar", "RGB to YIQ vs double");
+	KernelTest::Check yiq("scalar", "YIQ to Y'CbCr vs double");
+	KernelTest::Check ycc("scalar", "Y'CbCr to YIQ vs double");
+	KernelTest::Check rot("scalar", "chroma rotate vs double", 256);  // 8-bit sample LSBs
+	int				  y, i, q;
+	int				  dy, dcb, dcr;
+
+	for (unsigned int x = 0; x < t.bgra.size(); x++) {
+		const double r = (t.bgra[x] >> 16U) & 0xFFU;
+		const double g = (t.bgra[x] >> 8U) & 0xFFU;
+		const double b = t.bgra[x] & 0xFFU;
+
+		RGB_to_YIQ_row_scalar(&y, &i, &q, &t.bgra[x], 1);
+		rgb.compare(y, trunc(256.0 * ((0.30 * r) + (0.59 * g) + (0.11 * b))));
+		rgb.compare(i, trunc(256.0 * ((0.599 * r) - (0.2773 * g) - (0.3217 * b))));
+		rgb.compare(q, trunc(256.0 * ((0.213 * r) - (0.5251 * g) + (0.3121 * b))));
+	}
+
+	for (unsigned int x = 0; x < t.Y.size(); x++) {
+		const double sY = t.Y[x] / 256.0;
+		const double sI = t.I[x] / 256.0;
+		const double sQ = t.Q[x] / 256.0;
+
+		YIQ_to_YCbCr(dy, dcb, dcr, t.Y[x], t.I[x], t.Q[x]);
+		yiq.compare(dy, std::min(std::max(kernel_test_round(16.0 + ((219.0 / 255.0) * sY)), 16.0), 235.0));
+		yiq.compare(dcb, std::min(std::max(kernel_test_round(128.0 + ((224.0 / (255.0 * 1.772)) *
+																		((-1.106 * sI) + (1.703 * sQ)))),
+								 16.0), 240.0));
+		yiq.compare(dcr, std::min(std::max(kernel_test_round(128.0 + ((224.0 / (255.0 * 1.402)) *
+																		((0.956 * sI) + (0.621 * sQ)))),
+								 16.0), 240.0));
+	}
+
+	for (const bool full : {false, true}) {
+		const YCbCrToYIQ& m		= full ? ycbcr_in_full : ycbcr_in_limited;
+		const double	  ky	= full ? 1.0 : (255.0 / 219.0);
+		const double	  kc	= full ? 1.0 : (255.0 / 224.0);
+		const double	  black = full ? 0 : 16;
+
+		for (unsigned int x = 0; x < t.yc[0].size(); x++) {
+			const double l	= ky * (t.yc[0][x] - black);
+			const double cb = kc * (t.yc[1][x] - 128.0);
+			const double cr = kc * (t.yc[2][x] - 128.0);
+			const double r	= l + (1.402 * cr);
+			const double g	= l - (((0.114 * 1.772 * cb) + (0.299 * 1.402 * cr)) / 0.587);
+			const double b	= l + (1.772 * cb);
+
+			YCbCr_to_YIQ_row_scalar(&y, &i, &q, &t.yc[0][x], &t.yc[1][x], &t.yc[2][x], m, 1);
+			ycc.compare(y, kernel_test_round(256.0 * ((0.30 * r) + (0.59 * g) + (0.11 * b))));
+			ycc.compare(i, kernel_test_round(256.0 * ((0.599 * r) - (0.2773 * g) - (0.3217 * b))));
+			ycc.compare(q, kernel_test_round(256.0 * ((0.213 * r) - (0.5251 * g) + (0.3121 * b))));
+		}
+	}
+
+	// the angles of the chroma phase noise table, in 100ths of pi
+	for (int noise = -100; noise <= 100; noise++) {
+		const double a = (noise * M_PI) / 100.0;
+		const int	 c = lrint(cos(a) * (1 << chroma_rotate_shift));
+		const int	 s = lrint(sin(a) * (1 << chroma_rotate_shift));
+
+		for (unsigned int x = 0; x < t.I.size(); x += 97) {
+			int u = t.I[x];
+			int v = t.Q[x];
+
+			chroma_rotate_row_scalar(&u, &v, c, s, 1);
+			rot.compare(u, (t.I[x] * cos(a)) - (t.Q[x] * sin(a)));
+			rot.compare(v, (t.I[x] * sin(a)) + (t.Q[x] * cos(a)));
+		}
+	}
+
+	return rgb.report() & yiq.report() & ycc.report() & rot.report();
+}
+
+// the kernels select_simd_kernels() picked for the given level, against the scalar ones. the int16 working
+// format goes through the same kernels, so it is checked along with them.
+static bool test_simd_level(const KernelTest& t, const char* level) {
+	const unsigned int n = KernelTest::width;
+	KernelTest::Check  rgb(level, "RGB to YIQ");
+	KernelTest::Check  yiq(level, "YIQ to Y'CbCr");
+	KernelTest::Check  ycc(level, "Y'CbCr to YIQ");
+	KernelTest::Check  rot(level, "chroma rotate");
+	KernelTest::Check  rgb16(level, "RGB to YIQ (int16)");
+	KernelTest::Check  yiq16(level, "YIQ to Y'CbCr (int16)");
+	KernelTest::Check  rot16(level, "chroma rotate (int16)");
+	KernelTest::Check  iir(level, "scanline IIR");
+	KernelTest::Check  iir16(level, "scanline IIR (int16)");
+	std::vector<int>	 a[6];
+	std::vector<int16_t> a16[6];
+	std::vector<uint8_t> d[6];
+	ScanlineIIR			 filters[3];
+	const float			 rate = 315000000.F * 4.F / 88.F;  // 4fsc
+
+	filters[0].setLowpass(rate, 1300000.F, 3, 0.F, 2);
+	filters[1].setLowpass(rate, 3000000.F, 2, 0.F, 0);
+	filters[1].setHighboost(rate, 1500000.F, 16.F * 256.F, 1.6F);
+	filters[2].setLowpass(rate, 1300000.F * 4.F, 3, 0.F, 0);
+	filters[2].setSharpen(3.F);
+
+	for (auto& v : a) { v.resize(n); }
+	for (auto& v : a16) { v.resize(n); }
+	for (auto& v : d) { v.resize(n); }
+
+	for (unsigned int r = 0; r < KernelTest::rows; r++) {
+		const unsigned int w   = KernelTest::row_width(r);
+		const unsigned int o   = r * n;
+		const int		   c   = lrint(cos((static_cast<int>(r) - 32) * M_PI / 100.0) * (1 << chroma_rotate_shift));
+		const int		   s   = lrint(sin((static_cast<int>(r) - 32) * M_PI / 100.0) * (1 << chroma_rotate_shift));
+		const YCbCrToYIQ&  m   = (r & 1) != 0 ? ycbcr_in_full : ycbcr_in_limited;
+		const uint32_t*	   src = &t.bgra[o];
+
+		RGB_to_YIQ_row_scalar(a[0].data(), a[1].data(), a[2].data(), src, w);
+		RGB_to_YIQ_row(a[3].data(), a[4].data(), a[5].data(), src, w);
+		for (unsigned int x = 0; x < w; x++) {
+			for (unsigned int p = 0; p < 3; p++) { rgb.compare(a[3 + p][x], a[p][x]); }
+		}
+
+		RGB_to_YIQ_row16(a16[0].data(), a16[1].data(), a16[2].data(), src, w);
+		for (unsigned int x = 0; x < w; x++) {
+			for (unsigned int p = 0; p < 3; p++) {
+				rgb16.compare(a16[p][x], WorkFormat<int16_t>::clamp(a[p][x] >> WorkFormat<int16_t>::shift));
+			}
+		}
+
+		YCbCr_to_YIQ_row_scalar(a[0].data(), a[1].data(), a[2].data(), &t.yc[0][o], &t.yc[1][o], &t.yc[2][o], m, w);
+		YCbCr_to_YIQ_row(a[3].data(), a[4].data(), a[5].data(), &t.yc[0][o], &t.yc[1][o], &t.yc[2][o], m, w);
+		for (unsigned int x = 0; x < w; x++) {
+			for (unsigned int p = 0; p < 3; p++) { ycc.compare(a[3 + p][x], a[p][x]); }
+		}
+
+		YIQ_to_YCbCr_row_scalar(d[0].data(), d[1].data(), d[2].data(), &t.Y[o], &t.I[o], &t.Q[o], w);
+		YIQ_to_YCbCr_row(d[3].data(), d[4].data(), d[5].data(), &t.Y[o], &t.I[o], &t.Q[o], w);
+		for (unsigned int x = 0; x < w; x++) {
+			for (unsigned int p = 0; p < 3; p++) { yiq.compare(d[3 + p][x], d[p][x]); }
+		}
+
+		// int16 input is the int input at the int16 scale
+		for (unsigned int x = 0; x < w; x++) {
+			a16[0][x] = WorkFormat<int16_t>::clamp(t.Y[o + x] >> WorkFormat<int16_t>::shift);
+			a16[1][x] = WorkFormat<int16_t>::clamp(t.I[o + x] >> WorkFormat<int16_t>::shift);
+			a16[2][x] = WorkFormat<int16_t>::clamp(t.Q[o + x] >> WorkFormat<int16_t>::shift);
+			for (unsigned int p = 0; p < 3; p++) { a[p][x] = a16[p][x] * (1 << WorkFormat<int16_t>::shift); }
+		}
+		YIQ_to_YCbCr_row_scalar(d[0].data(), d[1].data(), d[2].data(), a[0].data(), a[1].data(), a[2].data(), w);
+		YIQ_to_YCbCr_row16(d[3].data(), d[4].data(), d[5].data(), a16[0].data(), a16[1].data(), a16[2].data(), w);
+		for (unsigned int x = 0; x < w; x++) {
+			for (unsigned int p = 0; p < 3; p++) { yiq16.compare(d[3 + p][x], d[p][x]); }
+		}
+
+		std::copy(&t.I[o], &t.I[o] + w, a[0].begin());
+		std::copy(&t.Q[o], &t.Q[o] + w, a[1].begin());
+		std::copy(&t.I[o], &t.I[o] + w, a[2].begin());
+		std::copy(&t.Q[o], &t.Q[o] + w, a[3].begin());
+		chroma_rotate_row_scalar(a[0].data(), a[1].data(), c, s, w);
+		chroma_rotate_row(a[2].data(), a[3].data(), c, s, w);
+		for (unsigned int x = 0; x < w; x++) {
+			rot.compare(a[2][x], a[0][x]);
+			rot.compare(a[3][x], a[1][x]);
+		}
+
+		for (unsigned int x = 0; x < w; x++) {
+			a16[0][x] = WorkFormat<int16_t>::clamp(t.I[o + x]);
+			a16[1][x] = WorkFormat<int16_t>::clamp(t.Q[o + x]);
+			a[0][x]	  = a16[0][x];
+			a[1][x]	  = a16[1][x];
+		}
+		chroma_rotate_row_scalar(a[0].data(), a[1].data(), c, s, w);
+		chroma_rotate_row16(a16[0].data(), a16[1].data(), c, s, w);
+		for (unsigned int x = 0; x < w; x++) {
+			rot16.compare(a16[0][x], WorkFormat<int16_t>::clamp(a[0][x]));
+			rot16.compare(a16[1][x], WorkFormat<int16_t>::clamp(a[1][x]));
+		}
+	}
+
+	// a full batch of scanlines per call, and a short one
+	for (const auto& f : filters) {
+		for (unsigned int count : {ScanlineIIR_lanes, std::max(ScanlineIIR_lanes - 1U, 1U)}) {
+			std::vector<std::vector<int>>	  ref(count);
+			std::vector<std::vector<int>>	  got(count);
+			std::vector<std::vector<int16_t>> ref16(count);
+			std::vector<std::vector<int16_t>> got16(count);
+			std::vector<int*>				  pref;
+			std::vector<int*>				  pgot;
+			std::vector<int16_t*>			  pref16;
+			std::vector<int16_t*>			  pgot16;
+
+			for (unsigned int l = 0; l < count; l++) {
+				ref[l].assign(t.Y.begin() + (l * n), t.Y.begin() + ((l + 1) * n));
+				got[l] = ref[l];
+				ref16[l].resize(n);
+				for (unsigned int x = 0; x < n; x++) {
+					ref16[l][x] = WorkFormat<int16_t>::clamp(ref[l][x] >> WorkFormat<int16_t>::shift);
+				}
+				got16[l] = ref16[l];
+				pref.push_back(ref[l].data());
+				pgot.push_back(got[l].data());
+				pref16.push_back(ref16[l].data());
+				pgot16.push_back(got16[l].data());
+			}
+
+			ScanlineIIR_rows_scalar<int>(f, pref.data(), count, n);
+			ScanlineIIR_rows(f, pgot.data(), count, n);
+			ScanlineIIR_rows_scalar<int16_t>(f, pref16.data(), count, n);
+			ScanlineIIR_rows16(f, pgot16.data(), count, n);
+			for (unsigned int l = 0; l < count; l++) {
+				for (unsigned int x = 0; x < n; x++) {
+					iir.compare(got[l][x], ref[l][x]);
+					iir16.compare(got16[l][x], ref16[l][x]);
+				}
+			}
+		}
+	}
+
+	return rgb.report() & yiq.report() & ycc.report() & rot.report() & rgb16.report() & yiq16.report() &
+		   rot16.report() & iir.report() & iir16.report();
+}
+
+static bool test_simd_kernels() {
+	static const std::pair<int, const char*> levels[] = {
+		{SIMD_SSE41, "SSE4.1"}, {SIMD_AVX2, "AVX2"}, {SIMD_AVX512, "AVX-512"}};
+	const KernelTest t;
+	bool			 ok = test_scalar_kernels(t);
+
+	for (const auto& level : levels) {
+		if (level.first > simd_cpu_level()) {
+			fprintf(stderr, "%-8s not supported by this CPU, skipped\n", level.second);
+			continue;
+		}
+		video_simd = level.first;
+		select_simd_kernels();
+		ok &= test_simd_level(t, level.second);
+	}
+
+	fprintf(stderr, ok ? "All kernels within 1 LSB\n" : "Kernel test FAILED\n");
+	return ok;
+}
+
+// one scanline of a planar Y'CbCr frame. chroma subsampled by 2 horizontally (hshift = 1) is brought up to full
+// width 256 pixels at a time on the way: even pixels are co-sited with a chroma sample, odd pixels take the
+// average of their neighbours. the int16 working format goes through the int converter like RGB_to_YIQ_row16().
+template <typename T>
+void YCbCr_to_YIQ_field_row(T* Y, T* I, T* Q, const uint8_t* y, const uint8_t* cb, const uint8_t* cr,
+	const unsigned int hshift, const YCbCrToYIQ& m, unsigned int width) {
+	constexpr int	  shift = WorkFormat<T>::shift;
+	const unsigned int cw	= (width + 1U) >> 1U;  // chroma samples per scanline, if subsampled
+	uint8_t			   tCb[256];
+	uint8_t			   tCr[256];
+	int				   tY[256];
+	int				   tI[256];
+	int				   tQ[256];
+
+	for (unsigned int x0 = 0; x0 < width; x0 += 256) {
+		const unsigned int n  = std::min(256U, width - x0);
+		const uint8_t*	 rb = cb + x0;
+		const uint8_t*	 rr = cr + x0;
+
+		if (hshift != 0) {
+			for (unsigned int x = 0; x < n; x++) {
+				const unsigned int c0 = (x0 + x) >> 1U;
+				const unsigned int c1 = std::min(c0 + ((x0 + x) & 1U), cw - 1U);
+
+				tCb[x] = static_cast<uint8_t>((cb[c0] + cb[c1] + 1) >> 1);
+				tCr[x] = static_cast<uint8_t>((cr[c0] + cr[c1] + 1) >> 1);
+			}
+			rb = tCb;
+			rr = tCr;
+		}
+
+		if constexpr (shift == 0) {
+			YCbCr_to_YIQ_row(Y + x0, I + x0, Q + x0, y + x0, rb, rr, m, n);
+		} else {
+			YCbCr_to_YIQ_row(tY, tI, tQ, y + x0, rb, rr, m, n);
+			for (unsigned int x = 0; x < n; x++) {
+				Y[x0 + x] = WorkFormat<T>::clamp(tY[x] >> shift);
+				I[x0 + x] = WorkFormat<T>::clamp(tI[x] >> shift);
+				Q[x0 + x] = WorkFormat<T>::clamp(tQ[x] >> shift);
+			}
+		}
+	}
+}
+
+static inline void ScanlineIIR_batch(const ScanlineIIR& f, int* const* rows, unsigned int count, unsigned int width) {
+	ScanlineIIR_rows(f, rows, count, width);
+}
+
+static inline void ScanlineIIR_batch(
+	const ScanlineIIR& f, int16_t* const* rows, unsigned int count, unsigned int width) {
+	ScanlineIIR_rows16(f, rows, count, width);
+}
+
+// run a scanline filter over the scanlines y0, y0+2, ... (< y1) of one field plane, ScanlineIIR_lanes per batch.
+template <typename T>
+void ScanlineIIR_strip(const ScanlineIIR& f, const FieldPlane<T>& plane, unsigned int y0, unsigned int y1, int width) {
+	T*			 P[16];
+	unsigned int n = 0;
+
+	for (auto y = y0; y < y1; y += 2) {
+		P[n++] = plane.row(y);
+		if (n == ScanlineIIR_lanes) {
+			ScanlineIIR_batch(f, P, n, width);
+			n = 0;
+		}
+	}
+	if (n != 0) { ScanlineIIR_batch(f, P, n, width); }
+}
+
+// every scanline filter composite_layer() uses, built ONCE from the parsed options by init() and then only read.
+// the stages take their (immutable) descriptors from here and only reset the per-scanline filter state.
+class CompositeFilterCache
+{
+public:
+	static constexpr float rate = (315000000.00F * 4.F) / 88.F;  // 315/88 Mhz rate * 4
+
+public:
+	void init() {
+		// NTSC YIQ bandwidth: I=1.3MHz Q=0.6MHz
+		chroma_lowpass_I.setLowpass(rate, 1300000.F, 3, 0.F, 2);
+		chroma_lowpass_Q.setLowpass(rate, 600000.F, 3, 0.F, 4);
+		chroma_lowpass_tv.setLowpass(rate, 2600000.F, 3, 0.F, 1);
+
+		if (composite_preemphasis != 0 && composite_preemphasis_cut > 0) {
+			preemphasis.setHighboost(rate, composite_preemphasis_cut, 16.F, composite_preemphasis);
+		}
+
+		if (emulating_vhs) {
+			if (output_vhs_tape_speed < VHS_SP || output_vhs_tape_speed > VHS_EP) { abort(); }
+
+			const float luma_cut	 = vhs_tape_speeds[output_vhs_tape_speed].luma_cut;
+			const float chroma_cut   = vhs_tape_speeds[output_vhs_tape_speed].chroma_cut;
+			const int	chroma_delay = vhs_tape_speeds[output_vhs_tape_speed].chroma_delay;
+
+			vhs_luma.setLowpass(rate, luma_cut, 3, 16.F, 0);  // vs 3.0MHz cutoff
+			vhs_luma.setHighboost(rate, luma_cut, 16.F, 1.6F);
+			vhs_chroma.setLowpass(rate, chroma_cut, 3, 0.F, chroma_delay);  // (divide by 2 for 4:2:2) vs 400KHz cutoff
+			vhs_sharpen.setLowpass(rate, luma_cut * 4.F, 3, 0.F, 0);
+			vhs_sharpen.setSharpen(vhs_out_sharpen * 2);
+		}
+
+		// the smoothed chroma phase noise is an integer within +/- video_chroma_phase_noise, in 100ths of pi
+		chroma_phase_cos.resize((video_chroma_phase_noise * 2) + 1);
+		chroma_phase_sin.resize((video_chroma_phase_noise * 2) + 1);
+		for (int noise = -video_chroma_phase_noise; noise <= video_chroma_phase_noise; noise++) {
+			const float pi = (static_cast<float>(noise) * M_PI) / 100.F;
+
+			chroma_phase_cos[noise + video_chroma_phase_noise] = lrint(cos(pi) * (1 << chroma_rotate_shift));
+			chroma_phase_sin[noise + video_chroma_phase_noise] = lrint(sin(pi) * (1 << chroma_rotate_shift));
+		}
+	}
+
+public:
+	ScanlineIIR chroma_lowpass_I;   // composite_lowpass()
+	ScanlineIIR chroma_lowpass_Q;   // composite_lowpass()
+	ScanlineIIR chroma_lowpass_tv;  // composite_lowpass_tv(), I and Q
+	ScanlineIIR preemphasis;		// composite preemphasis, luma
+	ScanlineIIR vhs_luma;			// VHS luma lowpass + boost
+	ScanlineIIR vhs_chroma;			// VHS chroma lowpass, I and Q
+	ScanlineIIR vhs_sharpen;		// VHS playback sharpening, luma
+
+	// composite_chroma_phase_noise(): the rotation for each noise value, at [noise + video_chroma_phase_noise]
+	std::vector<int> chroma_phase_cos;
+	std::vector<int> chroma_phase_sin;
+};
+
+CompositeFilterCache composite_filters;
+
+// -signal-width: composite_strip_back() scales every finished scanline from composite_width() samples up to the
+// output width, linearly, in the row it was written to. built by init() once the output size is known.
+class SignalScale
+{
+public:
+	void init() {
+		from   = composite_width();
+		active = from < output_width;
+		pos.assign(output_width, 0);
+		frac.assign(output_width, 0);
+		if (!active) { return; }
+
+		// the center of output sample x, in input samples, 16.16 fixed point
+		for (int x = 0; x < output_width; x++) {
+			long long p = ((((2LL * x) + 1) * from) << 16) / (2LL * output_width) - (1 << 15);
+
+			p		= std::min(std::max(p, 0LL), static_cast<long long>(from - 1) << 16);
+			pos[x]  = static_cast<int>(p >> 16);
+			frac[x] = static_cast<int>(p & 0xFFFF);
+		}
+	}
+	// the first composite_width() samples of p to output_width samples. every output sample lies left of its own
+	// position in the input, so going right to left nothing is overwritten before it has been read.
+	void row(uint8_t* p) const {
+		for (int x = output_width - 1; x >= 0; x--) {
+			const int i = pos[x];
+			const int j = std::min(i + 1, from - 1);
+
+			p[x] = static_cast<uint8_t>(((p[i] * (65536 - frac[x])) + (p[j] * frac[x]) + 32768) >> 16);
+		}
+	}
+
+public:
+	bool active{false};
+
+private:
+	int				 from{0};
+	std::vector<int> pos;
+	std::vector<int> frac;
+};
+
+SignalScale signal_scale;
+
+/* lighter-weight filtering, probably what your old CRT does to reduce color fringes a bit */
+template <typename T>
+void composite_lowpass_tv(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1,
+	unsigned long long /*fieldno*/) {
+	ScanlineIIR_strip(composite_filters.chroma_lowpass_tv, planes.I, y0, y1, dstframe->width);
+	ScanlineIIR_strip(composite_filters.chroma_lowpass_tv, planes.Q, y0, y1, dstframe->width);
+}
+
+template <typename T>
+void composite_lowpass(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1,
+	unsigned long long /*fieldno*/) {
+	/* lowpass the chroma more. composite video does not allocate as much bandwidth to color as luma. */
+	ScanlineIIR_strip(composite_filters.chroma_lowpass_I, planes.I, y0, y1, dstframe->width);
+	ScanlineIIR_strip(composite_filters.chroma_lowpass_Q, planes.Q, y0, y1, dstframe->width);
+}
+
+// the subcarrier phase of every scanline, and the 4 sample modulation pattern at that phase.
+// the phase of a scanline (0...3) only depends on fieldno & 3 and y & 7, whatever -vp and -vpo are, so this is
+// one table for the whole 4 field color sequence, built once by init() from the options.
+class SubcarrierPhase
+{
+public:
+	class Pattern
+	{
+	public:
+		unsigned int xi;	   // phase of the first sample
+		int8_t		 U[4];	 // sign of I in sample x & 3: the U/V multipliers rotated by xi
+		int8_t		 V[4];	 // sign of Q in sample x & 3
+		int8_t		 flip[4];  // -1 where sample x & 3 is on the negative half of the U or V sine wave
+	};
+
+public:
+	void init() {
+		static const int8_t Umult[4] = {1, 0, -1, 0};
+		static const int8_t Vmult[4] = {0, 1, 0, -1};
+
+		for (unsigned int f = 0; f < 4; f++) {
+			for (unsigned int y = 0; y < 8; y++) {
+				Pattern&	 p = patterns[f][y];
+				unsigned int xi;
+
+				if (video_scanline_phase_shift == 90) {
+					xi = (f + video_scanline_phase_shift_offset + (y >> 1)) & 3;
+				} else if (video_scanline_phase_shift == 180) {
+					xi = (((f + y) & 2) + video_scanline_phase_shift_offset) & 3;
+				} else if (video_scanline_phase_shift == 270) {
+					xi = (f + video_scanline_phase_shift_offset - (y >> 1)) & 3;
+				} else {
+					xi = video_scanline_phase_shift_offset & 3;
+				}
+
+				p.xi = xi;
+				for (unsigned int k = 0; k < 4; k++) {
+					p.U[k]	= Umult[(xi + k) & 3];
+					p.V[k]	= Vmult[(xi + k) & 3];
+					p.flip[k] = (((xi + k) & 3) >= 2) ? -1 : 1;
+				}
+			}
+		}
+	}
+
+	const Pattern& scanline(unsigned long long fieldno, unsigned int y) const { return patterns[fieldno & 3][y & 7]; }
+
+public:
+	Pattern patterns[4][8];
+};
+
+SubcarrierPhase subcarrier_phase;
+
+template <typename T>
+void chroma_into_luma(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1,
+	unsigned long long fieldno, int subcarrier_amplitude) {
+	/* render chroma into luma, fake subcarrier */
+	unsigned int x;
+	unsigned int y;
+
+	for (y = y0; y < y1; y += 2) {
+		const SubcarrierPhase::Pattern& p  = subcarrier_phase.scanline(fieldno, y);
+		T*								Y  = planes.Y.row(y);
+		T*								I  = planes.I.row(y);
+		T*								Q  = planes.Q.row(y);
+		unsigned int					xc = dstframe->width;
+
+		/* remember: this code assumes 4:2:2 */
+		/* NTS: the subcarrier is two sine waves superimposed on top of each other, 90 degrees apart */
+		for (x = 0; (x + 4) <= xc; x += 4) {
+			for (unsigned int k = 0; k < 4; k++) {
+				const int chroma = ((I[x + k] * p.U[k]) + (Q[x + k] * p.V[k])) * subcarrier_amplitude;
+
+				Y[x + k] = WorkFormat<T>::clamp(Y[x + k] + (chroma / 50));
+				I[x + k] = 0;
+				Q[x + k] = 0;
+			}
+		}
+		for (; x < xc; x++) {
+			const int chroma = ((I[x] * p.U[x & 3]) + (Q[x] * p.V[x & 3])) * subcarrier_amplitude;
+
+			Y[x] = WorkFormat<T>::clamp(Y[x] + (chroma / 50));
+			I[x] = 0;
+			Q[x] = 0;
+		}
+	}
+}
+
+// decode color from luma: a 4-tap box blur separates luma from the subcarrier, the sign pattern of the
+// subcarrier phase (xi) is taken back out, and I/Q are picked off alternate samples and interpolated.
+// done in one sweep over fixed size blocks (no VLA), each block computing luma, chroma and I/Q while it is in
+// L1. the loops are plain element-wise integer math, so the compiler vectorizes them.
+template <typename T>
+void chroma_from_luma(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1,
+	unsigned long long fieldno, int subcarrier_amplitude) {
+	constexpr int block = 256;
+	const int	  width = dstframe->width;
+	const int	  x_end = (width - 1) & ~1;  // I/Q are zero from here on (no sample to the right to interpolate)
+	int			  win[block + 12];			 // original luma, from 1 sample before the block to 11 after it
+	int			  luma[block + 8];			 // blurred luma, from the block start to 8 after it
+	int			  chroma[block + 8];		 // subcarrier, same samples
+	int			  Ie[(block / 2) + 1];		 // I/Q of the even samples of the block and the one after it
+	int			  Qe[(block / 2) + 1];
+
+	for (auto y = y0; y < y1; y += 2) {
+		const SubcarrierPhase::Pattern& p	  = subcarrier_phase.scanline(fieldno, y);
+		const unsigned int				xi	 = p.xi;
+		T*								Y	  = planes.Y.row(y);
+		T*								I	  = planes.I.row(y);
+		T*								Q	  = planes.Q.row(y);
+		int								before = 0;  // original luma of the sample before the block
+
+		for (int x0 = 0; x0 < width; x0 += block) {
+			const int n = std::min(block, width - x0);
+
+			// the blur is centered, over samples x-1...x+2. luma is overwritten as we go, so keep the originals
+			win[0] = before;
+			for (int i = 1; i < (block + 12); i++) { win[i] = ((x0 + i - 1) < width) ? Y[x0 + i - 1] : 0; }
+			before = win[block];
+
+			// flip the part of the sine wave that would correspond to negative U and V values.
+			// x0 is a multiple of 4, so sample i of the block is in phase i & 3 of the pattern.
+			for (int i = 0; i < (block + 8); i += 4) {
+				for (int k = 0; k < 4; k++) {
+					luma[i + k]   = (win[i + k] + win[i + k + 1] + win[i + k + 2] + win[i + k + 3]) / 4;
+					chroma[i + k] = (win[i + k + 3] - luma[i + k]) * p.flip[k];
+				}
+			}
+			// only whole groups of 4 samples are flipped, a partial group at either end is not. that can only be
+			// in the first 3 samples of the scanline and the last 3 (and whatever of the block is past the end).
+			const int head = std::min(block + 8, std::max(0, 3 - x0));
+			const int tail = std::max(head, std::min(block + 8, (width - 3) - x0));
+			const int edges[2][2] = {{0, head}, {tail, block + 8}};
+
+			for (const auto& e : edges) {
+				for (int i = e[0]; i < e[1]; i++) {
+					const int x = x0 + i;
+					const int k = (x + static_cast<int>(xi)) & 3;
+
+					if (k >= 2 && !(x >= k && (x - k + 3) < width)) { chroma[i] = -chroma[i]; }
+				}
+			}
+			if (subcarrier_amplitude != 50) {
+				for (int i = 0; i < (block + 8); i++) { chroma[i] = (chroma[i] * 50) / subcarrier_amplitude; }
+			}
+
+			for (int i = 0; i < n; i++) { Y[x0 + i] = luma[i]; }
+
+			/* decode the color right back out from the subcarrier we generated */
+			for (int j = 0; j <= (block / 2); j++) {
+				const int x = x0 + (j * 2);
+
+				Ie[j] = ((x + static_cast<int>(xi) + 1) < width) ? -chroma[(j * 2) + xi] : 0;
+				Qe[j] = ((x + static_cast<int>(xi) + 1) < width) ? -chroma[(j * 2) + xi + 1] : 0;
+			}
+			for (int i = 0; i < n; i++) {
+				const int j = i >> 1;
+
+				if ((x0 + i) >= x_end) {
+					I[x0 + i] = 0;
+					Q[x0 + i] = 0;
+				} else if ((i & 1) == 0) {
+					I[x0 + i] = WorkFormat<T>::clamp(Ie[j]);
+					Q[x0 + i] = WorkFormat<T>::clamp(Qe[j]);
+				} else {
+					I[x0 + i] = (WorkFormat<T>::clamp(Ie[j]) + WorkFormat<T>::clamp(Ie[j + 1])) >> 1;
+					Q[x0 + i] = (WorkFormat<T>::clamp(Qe[j]) + WorkFormat<T>::clamp(Qe[j + 1])) >> 1;
+				}
+			}
+		}
+	}
+}
+
+/* add video noise */
+template <typename T>
+void composite_video_noise(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1,
+	unsigned long long fieldno) {
+	const int noise_mod = (video_noise * 2) + 1; /* ,noise_mod = (video_noise * 255) / 100; */
+
+	for (auto y = y0; y < y1; y += 2) {
+		T*		 Y	 = planes.Y.row(y);
+		int		 noise = 0;
+		uint32_t rnd[256];
+
+		for (auto x0 = 0; x0 < dstframe->width; x0 += 256) {
+			const int xc = std::min(256, dstframe->width - x0);
+
+			noise_fill(rnd, xc, NOISE_VIDEO, fieldno, y, x0);
+			for (auto x = 0; x < xc; x++) {
+				Y[x0 + x] = WorkFormat<T>::clamp(Y[x0 + x] + (noise >> WorkFormat<T>::shift));
+				noise += (static_cast<int>(rnd[x] % noise_mod)) - video_noise;
+				noise /= 2;
+			}
+		}
+	}
+}
+
+// VHS head switching noise.
+// the first scanline after the switching point is displaced by ishif, each scanline after that by 7/8ths of the
+// one before, until that rounds down to nothing at end. init() is cheap and gives the same answer on every thread,
+// so each strip can shift its own scanlines.
+class HeadSwitching
+{
+public:
+	void init(const AVFrame* dstframe, unsigned int field, unsigned long long fieldno) {
+		unsigned int x;
+		unsigned int p;
+		float		 noise = 0.F;
+		float		 t;
+
+		twidth = dstframe->width + (dstframe->width / 10);
+
+		if (vhs_head_switching_phase_noise != 0) {
+			unsigned int x = noise_u32(NOISE_HEAD_SWITCHING, fieldno, 0);
+			x %= 2000000000U;
+			noise = (static_cast<float>(x) / 1000000000U) - 1.0F;
+			noise *= vhs_head_switching_phase_noise;
+		}
+
+		if (output_ntsc) {
+			t = twidth * 262.5F;
+		} else {
+			t = twidth * 312.5F;
+		}
+
+		p	 = static_cast<unsigned int>(fmod(vhs_head_switching_point + noise, 1.0F) * t);
+		start = ((p / twidth) * 2) + field;
+
+		p = static_cast<unsigned int>(fmod(vhs_head_switching_phase + noise, 1.0F) * t);
+		x = p % twidth;
+
+		if (output_ntsc) {
+			start -= (262 - 240) * 2;
+		} else {
+			start -= (312 - 288) * 2;
+		}
+
+		if (x >= (twidth / 2)) {
+			ishif = x - twidth;
+		} else {
+			ishif = x;
+		}
+
+		end = start + 2;
+		for (int shif = ishif; shif != 0; shif = (shif * 7) / 8) { end += 2; }
+	}
+
+	template <typename T>
+	void strip(const AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1) const {
+		// the switching point scanline itself is not displaced. y0 and start are both of the field's parity.
+		const int first = std::max(static_cast<int>(y0), start + 2);
+		const int last  = std::min(static_cast<int>(y1), end);
+		int		  shif  = ishif;
+
+		for (int k = start + 2; k < first; k += 2) { shif = (shif * 7) / 8; }
+
+		/* WARNING: This is not 100% accurate. On real VHS you'd see the line shifted over and the next
+		 * line's contents after hsync. */
+
+		/* luma. the chroma subcarrier is there, so this is all we have to do. */
+		for (int y = first; y < last; y += 2) {
+			displace(planes.Y.row(y), dstframe->width, shif);
+			shif = (shif * 7) / 8;
+		}
+	}
+
+private:
+	// sample x of the scanline becomes sample x + shif of the scanline as it would be with twidth - width samples of
+	// blanking after it, wrapping around. done in place.
+	template <typename T>
+	void displace(T* Y, const int width, const int shif) const {
+		const int blank = static_cast<int>(twidth) - width;
+
+		if (shif > 0) {
+			// [Y + shif, Y + width) then blanking, then wrapped around to the first shif - blank samples
+			const int wrap = shif - blank;
+
+			if (wrap <= 0) {
+				memmove(Y, Y + shif, (width - shif) * sizeof(T));
+				memset(Y + width - shif, 0, shif * sizeof(T));
+			} else {
+				std::rotate(Y, Y + shif, Y + width);
+				memmove(Y + width - wrap, Y + width - shif, wrap * sizeof(T));
+				memset(Y + width - shif, 0, blank * sizeof(T));
+			}
+		} else if (shif < 0) {
+			// the last -shif - blank samples wrapped around, then blanking, then [Y, Y + width + shif)
+			const int wrap = -shif - blank;
+
+			if (wrap <= 0) {
+				memmove(Y - shif, Y, (width + shif) * sizeof(T));
+				memset(Y, 0, -shif * sizeof(T));
+			} else {
+				std::rotate(Y, Y + width - wrap, Y + width);
+				memmove(Y - shif, Y + wrap, (width + shif) * sizeof(T));
+				memset(Y + wrap, 0, blank * sizeof(T));
+			}
+		}
+	}
+
+public:
+	unsigned int twidth;
+	int			 start;  // switching point scanline, negative if above the picture
+	int			 end;	// scanlines from here on are not displaced
+	int			 ishif;
+};
+
+/* add video noise */
+template <typename T>
+void composite_chroma_noise(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1,
+	unsigned long long fieldno) {
+	const int noise_mod = (video_chroma_noise * 2) + 1;
+
+	for (auto y = y0; y < y1; y += 2) {
+		T*		 U	  = planes.I.row(y);
+		T*		 V	  = planes.Q.row(y);
+		int		 noiseU = 0;
+		int		 noiseV = 0;
+		uint32_t rndU[256];
+		uint32_t rndV[256];
+
+		for (auto x0 = 0; x0 < dstframe->width; x0 += 256) {
+			const int xc = std::min(256, dstframe->width - x0);
+
+			noise_fill(rndU, xc, NOISE_CHROMA_U, fieldno, y, x0);
+			noise_fill(rndV, xc, NOISE_CHROMA_V, fieldno, y, x0);
+			for (auto x = 0; x < xc; x++) {
+				U[x0 + x] = WorkFormat<T>::clamp(U[x0 + x] + (noiseU >> WorkFormat<T>::shift));
+				V[x0 + x] = WorkFormat<T>::clamp(V[x0 + x] + (noiseV >> WorkFormat<T>::shift));
+				noiseU += (static_cast<int>(rndU[x] % noise_mod)) - video_chroma_noise;
+				noiseU /= 2;
+				noiseV += (static_cast<int>(rndV[x] % noise_mod)) - video_chroma_noise;
+				noiseV /= 2;
+			}
+		}
+	}
+}
+
+template <typename T>
+void composite_chroma_phase_noise(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1,
+	unsigned long long fieldno) {
+	const int		   noise_mod = (video_chroma_phase_noise * 2) + 1;
+	const unsigned int window	= 16;  // older scanlines contribute less than 1/65536th of their noise
+
+	for (auto y = y0; y < y1; y += 2) {
+		int noise = 0;
+
+		// the phase noise is smoothed from scanline to scanline. recompute that from the last few scanlines
+		// instead of carrying it down the field, so that every scanline can be done on its own.
+		for (auto ny = (y >= (window * 2U)) ? (y - (window * 2U)) + 2U : (y & 1U); ny <= y; ny += 2) {
+			noise += (static_cast<int>(noise_u32(NOISE_CHROMA_PHASE, fieldno, ny) % noise_mod)) -
+					 video_chroma_phase_noise;
+			noise /= 2;
+		}
+
+		// rotate (U, V), think of U as the x-coord and V as the y-coord, by noise 100ths of pi
+		chroma_rotate_field_row(planes.I.row(y), planes.Q.row(y),
+			composite_filters.chroma_phase_cos[noise + video_chroma_phase_noise],
+			composite_filters.chroma_phase_sin[noise + video_chroma_phase_noise], dstframe->width);
+	}
+}
+
+template <typename T>
+void composite_chroma_loss(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1,
+	unsigned long long fieldno) {
+	for (auto y = y0; y < y1; y += 2) {
+		T* U = planes.I.row(y);
+		T* V = planes.Q.row(y);
+
+		if ((noise_u32(NOISE_CHROMA_LOSS, fieldno, y) % 100000) < video_chroma_loss) {
+			memset(U, 0, dstframe->width * sizeof(T));
+			memset(V, 0, dstframe->width * sizeof(T));
+		}
+	}
+}
+
+// -measure-int16: every field is rendered in both working formats, one strip at a time, int16 first.
+// the int16 pass records each strip after every stage (at int scale) and the int32 pass compares against that,
+// so the report is the largest difference between the two formats after each stage over the whole run.
+class WorkFormatProbe
+{
+public:
+	class Stage
+	{
+	public:
+		const char*		 name{nullptr};
+		bool			 ycbcr{false};
+		std::vector<int> snap;
+		int				 maxdev[3]{0, 0, 0};
+	};
+
+public:
+	template <typename T>
+	void stage(const char* name, const FieldPlanes<T>& planes, unsigned int y0, unsigned int y1, unsigned int width) {
+		constexpr int scale = 1 << WorkFormat<T>::shift;
+		Stage&		  st	= find(name, (((y1 - y0) + 1) / 2) * width * 3);
+		size_t		  i	 = 0;
+
+		for (auto y = y0; y < y1; y += 2) {
+			const T* P[3] = {planes.Y.row(y), planes.I.row(y), planes.Q.row(y)};
+
+			for (unsigned int c = 0; c < 3; c++) {
+				for (unsigned int x = 0; x < width; x++) { sample(st, i++, c, P[c][x] * scale); }
+			}
+		}
+	}
+	void output(const char* name, const AVFrame* dstframe, unsigned int y0, unsigned int y1) {
+		Stage& st = find(name, (((y1 - y0) + 1) / 2) * dstframe->width * 3);
+		size_t i  = 0;
+
+		st.ycbcr = true;
+		for (auto y = y0; y < y1; y += 2) {
+			for (unsigned int c = 0; c < 3; c++) {
+				const uint8_t* P = dstframe->data[c] + (dstframe->linesize[c] * y);
+
+				for (int x = 0; x < dstframe->width; x++) { sample(st, i++, c, P[x]); }
+			}
+		}
+	}
+	void report() const {
+		fprintf(stderr, "int16 working format, max deviation from int32 after each stage:\n");
+		for (const auto& st : stages) {
+			fprintf(stderr, "  %-28s %s %6d %s %6d %s %6d\n", st.name, st.ycbcr ? "Y'" : "Y ", st.maxdev[0],
+				st.ycbcr ? "Cb" : "I ", st.maxdev[1], st.ycbcr ? "Cr" : "Q ", st.maxdev[2]);
+		}
+		fprintf(stderr, "  (Y/I/Q at int32 scale, luma 0...65280; Y'/Cb/Cr in 8-bit levels)\n");
+	}
+
+private:
+	Stage& find(const char* name, const size_t samples) {
+		for (auto& st : stages) {
+			if (strcmp(st.name, name) == 0) {
+				if (record) { st.snap.resize(samples); }
+				return st;
+			}
+		}
+
+		stages.emplace_back();
+		stages.back().name = name;
+		stages.back().snap.resize(samples);
+		return stages.back();
+	}
+	void sample(Stage& st, const size_t i, const unsigned int c, const int v) {
+		if (record) {
+			st.snap[i] = v;
+		} else {
+			st.maxdev[c] = std::max(st.maxdev[c], abs(v - st.snap[i]));
+		}
+	}
+
+public:
+	bool			   record{false};  // true for the int16 pass, false for the int32 pass
+	std::vector<Stage> stages;		   // in the order they first ran
+};
+
+WorkFormatProbe  work_format_probe;
+WorkFormatProbe* composite_probe = nullptr;  // &work_format_probe while a -measure-int16 field renders
+
+template <typename T>
+static inline void probe_stage(
+	const char* name, const FieldPlanes<T>& planes, unsigned int y0, unsigned int y1, unsigned int width) {
+	if (composite_probe != nullptr) { composite_probe->stage(name, planes, y0, y1, width); }
+}
+
+// the options composite_field() branches on, as compile-time constants. select_composite_kernels() picks the
+// instantiation matching the command line once at startup, so that none of this is tested again per strip or
+// scanline.
+template <bool _vhs, bool _vblend, bool _svideo_out, bool _decode_color>
+class CompositeConfig
+{
+public:
+	static constexpr bool vhs		   = _vhs;		   // emulating_vhs
+	static constexpr bool vblend	   = _vblend;	   // VHS vertical chroma blend (NTSC only)
+	static constexpr bool svideo_out   = _svideo_out;	// vhs_svideo_out
+	static constexpr bool decode_color = _decode_color;  // !nocolor_subcarrier
+};
+
+// the front of the chain: the source to YIQ and the composite in lowpass. the same for every field of the same
+// parity of a source frame (see SourceCache).
+// This code assumes ARGB or planar Y'CbCr in, YUV444P out and the frames match resolution/
+template <typename T>
+void composite_strip_source(AVFrame* dstframe, AVFrame* srcframe, FieldPlanes<T>& planes, unsigned char opposite,
+	unsigned int y0, unsigned int y1, unsigned long long fieldno) {
+	unsigned int hshift = 0;
+	unsigned int vshift = 0;
+	bool		 full_range = false;
+	const bool	 ycbcr		= ycbcr_source_format(srcframe, hshift, vshift, full_range);
+
+	for (auto row = y0; row < y1; row += 2) {
+		/* each line of srcframe->data[0] has padding added to it, so step by linesize, not width. */
+		const unsigned int srow = std::min(row + opposite, static_cast<unsigned int>(dstframe->height) - 1U);
+
+		if (ycbcr) {
+			const unsigned int crow = srow >> vshift;
+
+			YCbCr_to_YIQ_field_row(planes.Y.row(row), planes.I.row(row), planes.Q.row(row),
+				srcframe->data[0] + (srcframe->linesize[0] * srow), srcframe->data[1] + (srcframe->linesize[1] * crow),
+				srcframe->data[2] + (srcframe->linesize[2] * crow), hshift,
+				full_range ? ycbcr_in_full : ycbcr_in_limited, dstframe->width);
+		} else {
+			/* colors in srcframe are actually BGRA, which as uint32_t puts B in the low byte. */
+			auto src = reinterpret_cast<const uint32_t*>(srcframe->data[0] + (srcframe->linesize[0] * srow));
+
+			RGB_to_YIQ_field_row(planes.Y.row(row), planes.I.row(row), planes.Q.row(row), src, dstframe->width);
+		}
+	}
+	probe_stage("RGB to YIQ", planes, y0, y1, dstframe->width);
+
+	if (composite_in_chroma_lowpass) {
+		composite_lowpass(dstframe, planes, y0, y1, fieldno);
+		probe_stage("composite in lowpass", planes, y0, y1, dstframe->width);
+	}
+}
+
+// rows y0, y0 + 2, ... y1 - 1 of a field plane are back to back
+template <typename T>
+void composite_strip_copy(FieldPlanes<T>& to, const FieldPlanes<T>& from, unsigned int y0, unsigned int y1) {
+	const size_t n = static_cast<size_t>(((y1 - y0) + 1) / 2) * to.Y.stride * sizeof(T);
+
+	memcpy(to.Y.row(y0), from.Y.row(y0), n);
+	memcpy(to.I.row(y0), from.I.row(y0), n);
+	memcpy(to.Q.row(y0), from.Q.row(y0), n);
+}
+
+// everything composite_field() does to one strip up to the VHS vertical chroma blend.
+template <typename T, class K>
+void composite_strip_front(AVFrame* dstframe, AVFrame* srcframe, FieldPlanes<T>& planes, const FrontCache& front,
+	const HeadSwitching& hs, unsigned char opposite, unsigned int y0, unsigned int y1, unsigned long long fieldno) {
+	if (front.hit) {
+		composite_strip_copy(planes, front.planes->of<T>(), y0, y1);
+	} else {
+		composite_strip_source(dstframe, srcframe, planes, opposite, y0, y1, fieldno);
+		if (front.planes != nullptr) { composite_strip_copy(front.planes->of<T>(), planes, y0, y1); }
+	}
+	chroma_into_luma(dstframe, planes, y0, y1, fieldno, subcarrier_amplitude);
+	probe_stage("chroma into luma", planes, y0, y1, dstframe->width);
+
+	/* video composite preemphasis */
+	if (composite_preemphasis != 0 && composite_preemphasis_cut > 0) {
+		ScanlineIIR_strip(composite_filters.preemphasis, planes.Y, y0, y1, dstframe->width);
+		probe_stage("preemphasis", planes, y0, y1, dstframe->width);
+	}
+
+	if (video_noise != 0) {
+		composite_video_noise(dstframe, planes, y0, y1, fieldno);
+		probe_stage("video noise", planes, y0, y1, dstframe->width);
+	}
+
+	if (vhs_head_switching) {
+		hs.strip(dstframe, planes, y0, y1);
+		probe_stage("head switching", planes, y0, y1, dstframe->width);
+	}
+
+	if constexpr (K::decode_color) {
+		chroma_from_luma(dstframe, planes, y0, y1, fieldno, subcarrier_amplitude_back);
+		probe_stage("chroma from luma", planes, y0, y1, dstframe->width);
+	}
+
+	if (video_chroma_noise != 0) {
+		composite_chroma_noise(dstframe, planes, y0, y1, fieldno);
+		probe_stage("chroma noise", planes, y0, y1, dstframe->width);
+	}
+	if (video_chroma_phase_noise != 0) {
+		composite_chroma_phase_noise(dstframe, planes, y0, y1, fieldno);
+		probe_stage("chroma phase noise", planes, y0, y1, dstframe->width);
+	}
+
+	// NTS: At this point, the video best resembles what you'd get from a typical DVD player's composite video output.
+	//      Slightly blurry, some color artifacts, and edges will have that "buzz" effect, but still a good picture.
+
+	if constexpr (K::vhs) {
+		// luma lowpass
+		ScanlineIIR_strip(composite_filters.vhs_luma, planes.Y, y0, y1, dstframe->width);
+
+		// chroma lowpass
+		ScanlineIIR_strip(composite_filters.vhs_chroma, planes.I, y0, y1, dstframe->width);
+		ScanlineIIR_strip(composite_filters.vhs_chroma, planes.Q, y0, y1, dstframe->width);
+		probe_stage("VHS lowpass", planes, y0, y1, dstframe->width);
+	}
+}
+
+// everything composite_field() does to one strip after the VHS vertical chroma blend.
+template <typename T, class K>
+void composite_strip_back(
+	AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int y0, unsigned int y1, unsigned long long fieldno) {
+	if constexpr (K::vhs) {
+		// VHS decks tend to sharpen the picture on playback
+		if (true /*TODO make option*/) {
+			ScanlineIIR_strip(composite_filters.vhs_sharpen, planes.Y, y0, y1, dstframe->width);
+			probe_stage("VHS sharpen", planes, y0, y1, dstframe->width);
+		}
+
+		if constexpr (!K::svideo_out) {
+			chroma_into_luma(dstframe, planes, y0, y1, fieldno, subcarrier_amplitude);
+			chroma_from_luma(dstframe, planes, y0, y1, fieldno, subcarrier_amplitude);
+			probe_stage("VHS composite out", planes, y0, y1, dstframe->width);
+		}
+	}
+
+	if (video_chroma_loss != 0) {
+		composite_chroma_loss(dstframe, planes, y0, y1, fieldno);
+		probe_stage("chroma loss", planes, y0, y1, dstframe->width);
+	}
+
+	if (composite_out_chroma_lowpass) {
+		if (composite_out_chroma_lowpass_lite) {
+			composite_lowpass_tv(dstframe, planes, y0, y1, fieldno);
+		} else {
+			composite_lowpass(dstframe, planes, y0, y1, fieldno);
+		}
+		probe_stage("composite out lowpass", planes, y0, y1, dstframe->width);
+	}
+
+	for (auto y = y0; y < y1; y += 2) {
+		YIQ_to_YCbCr_field_row(dstframe->data[0] + (dstframe->linesize[0] * y),
+			dstframe->data[1] + (dstframe->linesize[1] * y), dstframe->data[2] + (dstframe->linesize[2] * y),
+			planes.Y.row(y), planes.I.row(y), planes.Q.row(y), dstframe->width);
+	}
+	if (composite_probe != nullptr) { composite_probe->output("YIQ to Y'CbCr", dstframe, y0, y1); }
+
+	if (signal_scale.active) {
+		for (auto y = y0; y < y1; y += 2) {
+			for (unsigned int c = 0; c < 3; c++) { signal_scale.row(dstframe->data[c] + (dstframe->linesize[c] * y)); }
+		}
+	}
+}
+
+// VHS decks also vertically smear the chroma subcarrier using a delay line
+// to add the previous line's color subcarrier to the current line's color subcarrier.
+// note that phase changes in NTSC are compensated for by the VHS deck to make the
+// phase line up per scanline (else summing the previous line's carrier would
+// cancel it out).
+// this is the one stage with a real vertical dependency, so split the columns across threads instead.
+template <typename T>
+void composite_vert_blend(AVFrame* dstframe, FieldPlanes<T>& planes, unsigned int field) {
+	const int xstep = 256;
+
+#pragma omp for schedule(static)
+	for (int x0 = 0; x0 < dstframe->width; x0 += xstep) {
+		const int xc = std::min(xstep, dstframe->width - x0);
+		int		  delayU[xstep];
+		int		  delayV[xstep];
+
+		memset(delayU, 0, xc * sizeof(int));
+		memset(delayV, 0, xc * sizeof(int));
+		for (auto y = (field + 2); y < dstframe->height; y += 2) {
+			T*	U = planes.I.row(y) + x0;
+			T*	V = planes.Q.row(y) + x0;
+			int cU;
+			int cV;
+
+			for (auto x = 0; x < xc; x++) {
+				cU		  = U[x];
+				cV		  = V[x];
+				U[x]	  = (delayU[x] + cU + 1) >> 1;
+				V[x]	  = (delayV[x] + cV + 1) >> 1;
+				delayU[x] = cU;
+				delayV[x] = cV;
+			}
+		}
+	}
 }
 
-void YIQ_to_RGB(int& r, int& g, int& b, int Y, int I, int Q) {
-	// FIXME
-	r = static_cast<int>(((1.000 * Y) + (0.956 * I) + (0.621 * Q)) / 256);
-	g = static_cast<int>(((1.000 * Y) + (-0.272 * I) + (-0.647 * Q)) / 256);
-	b = static_cast<int>(((1.000 * Y) + (-1.106 * I) + (1.703 * Q)) / 256);
-	if (r < 0) {
-		r = 0;
-	} else if (r > 255) {
-		r = 255;
-	}
-	if (g < 0) {
-		g = 0;
-	} else if (g > 255) {
-		g = 255;
-	}
-	if (b < 0) {
-		b = 0;
-	} else if (b > 255) {
-		b = 255;
+// how composite_field() divides one field into strips of ScanlineIIR_lanes scanlines
+class FieldStrips
+{
+public:
+	FieldStrips(const AVFrame* dstframe, const unsigned int _field) : field(_field), height(dstframe->height) {
+		const int rows = (height > static_cast<int>(field)) ? ((height - field + 1) / 2) : 0;
+
+		count = (rows + ScanlineIIR_lanes - 1) / ScanlineIIR_lanes;
 	}
-}
 
-/* lighter-weight filtering, probably what your old CRT does to reduce color fringes a bit */
-void composite_lowpass_tv(
-	AVFrame* dstframe, int* /*fY*/, int* fI, int* fQ, unsigned int field, unsigned long long /*fieldno*/) {
-	unsigned int x;
-	unsigned int y;
+	unsigned int y0(const int st) const { return field + (st * ScanlineIIR_lanes * 2); }
+	unsigned int y1(const int st) const { return std::min(y0(st) + (ScanlineIIR_lanes * 2), height); }
 
-	{
-		for (unsigned int p = 1; p <= 2; p++) {
-			for (y = field; y < dstframe->height; y += 2) {
-				int*		  P = ((p == 1) ? fI : fQ) + (dstframe->width * y);
-				LowpassFilter lp[3];
-				float		  cutoff;
-				int			  delay;
-				float		  s;
-
-				cutoff = 2600000.F;
-				delay  = 1;
-
-				for (auto& f : lp) {
-					f.setFilter((315000000.00F * 4.F) / 88.F, cutoff);  // 315/88 Mhz rate * 4
-					f.resetFilter(0.F);
-				}
+public:
+	unsigned int field;
+	unsigned int height;
+	int			 count;
+};
 
-				for (x = 0; x < dstframe->width; x++) {
-					s = P[x];
-					for (auto& f : lp) { s = f.lowpass(s); }
-					if (x >= delay) { P[x - delay] = s; }
-				}
-			}
+// runs every stage of composite_layer() on one field, in working format T.
+// called by all threads of the parallel region, which divide up the field in strips of ScanlineIIR_lanes scanlines.
+// every stage is horizontal only, except the VHS vertical chroma blend, so a strip goes through the whole chain
+// while it is still in L1/L2 instead of streaming the field planes through memory once per stage. the vertical
+// blend (when enabled) splits the chain in two, with the columns divided up between the threads in between.
+template <typename T, class K>
+void composite_field(AVFrame* dstframe, AVFrame* srcframe, FieldPlanes<T>& planes, const FrontCache& front,
+	unsigned char opposite, unsigned int field, unsigned long long fieldno) {
+	const FieldStrips strips(dstframe, field);
+	HeadSwitching	  hs;
+
+	if (vhs_head_switching) { hs.init(dstframe, field, fieldno); }
+
+#pragma omp for schedule(static)
+	for (int st = 0; st < strips.count; st++) {
+		composite_strip_front<T, K>(
+			dstframe, srcframe, planes, front, hs, opposite, strips.y0(st), strips.y1(st), fieldno);
+		if constexpr (!K::vblend) {
+			composite_strip_back<T, K>(dstframe, planes, strips.y0(st), strips.y1(st), fieldno);
 		}
 	}
-}
-
-void composite_lowpass(
-	AVFrame* dstframe, int* /*fY*/, int* fI, int* fQ, unsigned int field, unsigned long long /*fieldno*/) {
-	unsigned int x;
-	unsigned int y;
 
-	{ /* lowpass the chroma more. composite video does not allocate as much bandwidth to color as luma. */
-		for (unsigned int p = 1; p <= 2; p++) {
-			for (y = field; y < dstframe->height; y += 2) {
-				int*		  P = ((p == 1) ? fI : fQ) + (dstframe->width * y);
-				LowpassFilter lp[3];
-				float		  cutoff;
-				int			  delay;
-				float		  s;
-
-				// NTSC YIQ bandwidth: I=1.3MHz Q=0.6MHz
-				cutoff = (p == 1) ? 1300000.F : 600000.F;
-				delay  = (p == 1) ? 2 : 4;
-
-				for (auto& f : lp) {
-					f.setFilter((315000000.00F * 4.F) / 88.F, cutoff);  // 315/88 Mhz rate * 4
-					f.resetFilter(0.F);
-				}
+	if constexpr (K::vblend) {
+		composite_vert_blend(dstframe, planes, field);
 
-				for (x = 0; x < dstframe->width; x++) {
-					s = P[x];
-					for (auto& f : lp) { s = f.lowpass(s); }
-					if (x >= delay) { P[x - delay] = s; }
-				}
-			}
+#pragma omp for schedule(static)
+		for (int st = 0; st < strips.count; st++) {
+			composite_strip_back<T, K>(dstframe, planes, strips.y0(st), strips.y1(st), fieldno);
 		}
 	}
 }
 
-void chroma_into_luma(AVFrame* dstframe, int* fY, int* fI, int* fQ, unsigned int field, unsigned long long fieldno,
-	int subcarrier_amplitude) {
-	/* render chroma into luma, fake subcarrier */
-	unsigned int x;
-	unsigned int y;
-
-	for (y = field; y < dstframe->height; y += 2) {
-		static const int8_t Umult[4] = {1, 0, -1, 0};
-		static const int8_t Vmult[4] = {0, 1, 0, -1};
-		int*				Y		 = fY + (y * dstframe->width);
-		int*				I		 = fI + (y * dstframe->width);
-		int*				Q		 = fQ + (y * dstframe->width);
-		unsigned int		xc		 = dstframe->width;
-		unsigned int		xi;
-
-		if (video_scanline_phase_shift == 90) {
-			xi = (fieldno + video_scanline_phase_shift_offset + (y >> 1)) & 3;
-		} else if (video_scanline_phase_shift == 180) {
-			xi = (((fieldno + y) & 2) + video_scanline_phase_shift_offset) & 3;
-		} else if (video_scanline_phase_shift == 270) {
-			xi = (fieldno + video_scanline_phase_shift_offset - (y >> 1)) & 3;
-		} else {
-			xi = video_scanline_phase_shift_offset & 3;
+// -measure-int16: render the field in int16 and then in int32 (which is what gets output), strip by strip on this
+// thread, with the probe comparing the two after every stage.
+template <class K>
+void composite_measure(AVFrame* dstframe, AVFrame* srcframe, CompositePlaneArena& arena, unsigned char opposite,
+	unsigned int field, unsigned long long fieldno) {
+	const FieldStrips strips(dstframe, field);
+	HeadSwitching	  hs;
+
+	if (vhs_head_switching) { hs.init(dstframe, field, fieldno); }
+
+	composite_probe = &work_format_probe;
+	for (int st = 0; st < strips.count; st++) {
+		work_format_probe.record = true;
+		composite_strip_front<int16_t, K>(
+			dstframe, srcframe, arena.planes16, FrontCache(), hs, opposite, strips.y0(st), strips.y1(st), fieldno);
+		if constexpr (!K::vblend) {
+			composite_strip_back<int16_t, K>(dstframe, arena.planes16, strips.y0(st), strips.y1(st), fieldno);
 		}
 
-		/* remember: this code assumes 4:2:2 */
-		/* NTS: the subcarrier is two sine waves superimposed on top of each other, 90 degrees apart */
-		for (x = 0; x < xc; x++) {
-			unsigned int sxi = xi + x;
-			int			 chroma;
+		work_format_probe.record = false;
+		composite_strip_front<int, K>(
+			dstframe, srcframe, arena.planes, FrontCache(), hs, opposite, strips.y0(st), strips.y1(st), fieldno);
+		if constexpr (!K::vblend) {
+			composite_strip_back<int, K>(dstframe, arena.planes, strips.y0(st), strips.y1(st), fieldno);
+		}
+	}
 
-			chroma = I[x] * subcarrier_amplitude * Umult[sxi & 3];
-			chroma += Q[x] * subcarrier_amplitude * Vmult[sxi & 3];
-			Y[x] += (chroma / 50);
-			I[x] = 0;
-			Q[x] = 0;
+	if constexpr (K::vblend) {
+		work_format_probe.record = true;
+		composite_vert_blend(dstframe, arena.planes16, field);
+		probe_stage("VHS vertical chroma blend", arena.planes16, field, dstframe->height, dstframe->width);
+		work_format_probe.record = false;
+		composite_vert_blend(dstframe, arena.planes, field);
+		probe_stage("VHS vertical chroma blend", arena.planes, field, dstframe->height, dstframe->width);
+
+		for (int st = 0; st < strips.count; st++) {
+			work_format_probe.record = true;
+			composite_strip_back<int16_t, K>(dstframe, arena.planes16, strips.y0(st), strips.y1(st), fieldno);
+			work_format_probe.record = false;
+			composite_strip_back<int, K>(dstframe, arena.planes, strips.y0(st), strips.y1(st), fieldno);
 		}
 	}
+	composite_probe = nullptr;
 }
 
-void chroma_from_luma(AVFrame* dstframe, int* fY, int* fI, int* fQ, unsigned int field, unsigned long long fieldno,
-	int subcarrier_amplitude) {
-	/* decode color from luma */
-	int			 chroma[dstframe->width];  // WARNING: This is more GCC-specific C++ than normal
-	unsigned int x;
-	unsigned int y;
+template <typename T>
+using composite_field_func = void (*)(AVFrame* dstframe, AVFrame* srcframe, FieldPlanes<T>& planes,
+	const FrontCache& front, unsigned char opposite, unsigned int field, unsigned long long fieldno);
+using composite_measure_func = void (*)(AVFrame* dstframe, AVFrame* srcframe, CompositePlaneArena& arena,
+	unsigned char opposite, unsigned int field, unsigned long long fieldno);
 
-	for (y = field; y < dstframe->height; y += 2) {
-		int* Y		  = fY + (y * dstframe->width);
-		int* I		  = fI + (y * dstframe->width);
-		int* Q		  = fQ + (y * dstframe->width);
-		int  delay[4] = {0, 0, 0, 0};
-		int  sum	  = 0;
-		int  c;
-
-		// precharge by 2 pixels to center box blur
-		delay[2] = Y[0];
-		sum += delay[2];
-		delay[3] = Y[1];
-		sum += delay[3];
-		for (x = 0; x < dstframe->width; x++) {
-			if ((x + 2) < dstframe->width) {
-				c = Y[x + 2];
-			} else {
-				c = 0;
-			}
+// one CompositeConfig instantiation of the field renderers
+class CompositeKernels
+{
+public:
+	composite_field_func<int>	  field{nullptr};
+	composite_field_func<int16_t> field16{nullptr};
+	composite_measure_func		  measure{nullptr};
+};
 
-			sum -= delay[0];
-			for (unsigned int j = 0; j < (4 - 1); j++) { delay[j] = delay[j + 1]; }
-			delay[3] = c;
-			sum += delay[3];
-			Y[x]	  = sum / 4;
-			chroma[x] = c - Y[x];
-		}
+CompositeKernels composite_kernels;
 
-		{
-			unsigned int xi = 0;
-
-			if (video_scanline_phase_shift == 90) {
-				xi = (fieldno + video_scanline_phase_shift_offset + (y >> 1)) & 3;
-			} else if (video_scanline_phase_shift == 180) {
-				xi = (((fieldno + y) & 2) + video_scanline_phase_shift_offset) & 3;
-			} else if (video_scanline_phase_shift == 270) {
-				xi = (fieldno + video_scanline_phase_shift_offset - (y >> 1)) & 3;
-			} else {
-				xi = video_scanline_phase_shift_offset & 3;
-			}
+template <class K>
+static CompositeKernels composite_kernels_of() {
+	return {composite_field<int, K>, composite_field<int16_t, K>, composite_measure<K>};
+}
 
-			for (x = ((4 - xi) & 3); (x + 3) < dstframe->width;
-				 x += 4) {  // flip the part of the sine wave that would correspond to negative U and V values
-				chroma[x + 2] = -chroma[x + 2];
-				chroma[x + 3] = -chroma[x + 3];
-			}
+template <bool vhs, bool vblend, bool svideo_out>
+static CompositeKernels composite_kernels_color() {
+	if (nocolor_subcarrier) { return composite_kernels_of<CompositeConfig<vhs, vblend, svideo_out, false>>(); }
+	return composite_kernels_of<CompositeConfig<vhs, vblend, svideo_out, true>>();
+}
 
-			for (x = 0; x < dstframe->width; x++) { chroma[x] = (chroma[x] * 50) / subcarrier_amplitude; }
+// pick the field renderers once at startup, from the parsed options
+void select_composite_kernels() {
+	subcarrier_phase.init();
 
-			/* decode the color right back out from the subcarrier we generated */
-			for (x = 0; (x + xi + 1) < dstframe->width; x += 2) {
-				I[x] = -chroma[x + xi + 0];
-				Q[x] = -chroma[x + xi + 1];
-			}
-			for (; x < dstframe->width; x += 2) {
-				I[x] = 0;
-				Q[x] = 0;
-			}
-			for (x = 0; (x + 2) < dstframe->width; x += 2) {
-				I[x + 1] = (I[x] + I[x + 2]) >> 1;
-				Q[x + 1] = (Q[x] + Q[x + 2]) >> 1;
-			}
-			for (; x < dstframe->width; x++) {
-				I[x] = 0;
-				Q[x] = 0;
-			}
-		}
+	// without VHS emulation the blend and S-Video out do not apply, so they do not get instantiations of their own
+	if (!emulating_vhs) {
+		composite_kernels = composite_kernels_color<false, false, false>();
+	} else if (vhs_chroma_vert_blend && output_ntsc) {
+		composite_kernels = vhs_svideo_out ? composite_kernels_color<true, true, true>()
+										   : composite_kernels_color<true, true, false>();
+	} else {
+		composite_kernels = vhs_svideo_out ? composite_kernels_color<true, false, true>()
+										   : composite_kernels_color<true, false, false>();
 	}
 }
 
-// This code assumes ARGB and the frame match resolution/
-void composite_layer(
-	AVFrame* dstframe, AVFrame* srcframe, InputFile& /*inputfile*/, unsigned int field, unsigned long long fieldno) {
+// false if nothing was drawn, in which case the scanlines of the field in dstframe are left as they were
+bool composite_layer(CompositeRenderContext& ctx, AVFrame* dstframe, AVFrame* srcframe, InputFile& inputfile,
+	unsigned int field, unsigned long long fieldno) {
 	unsigned char opposite;
-	unsigned int  shr;
-	auto		  dstframe_pixels = dstframe->width * dstframe->height;
-	int *		  fY, *fI, *fQ;
-	int			  r;
-	int			  g;
-	int			  b;
-
-	if (dstframe == nullptr || srcframe == nullptr) { return; }
-	if (dstframe->data[0] == nullptr || srcframe->data[0] == nullptr) { return; }
-	if (dstframe->linesize[0] < (dstframe->width * 4)) {
-		return;  // ARGB
+	unsigned int  hshift;
+	unsigned int  vshift;
+	bool		  full_range;
+	AVFrame		  signal;
+
+	if (dstframe == nullptr || srcframe == nullptr) { return false; }
+	if (dstframe->data[0] == nullptr || srcframe->data[0] == nullptr) { return false; }
+	if (dstframe->format != AV_PIX_FMT_YUV444P) { return false; }
+	if (signal_scale.active) {
+		// -signal-width: the stages take the width to work at from dstframe. give them the same planes, narrower,
+		// and composite_strip_back() scales each scanline up to the full width after. (a view: it owns nothing)
+		if (dstframe->width != output_width) { return false; }
+		signal		 = *dstframe;
+		signal.width = composite_width();
+		dstframe	 = &signal;
 	}
-	if (srcframe->linesize[0] < (srcframe->width * 4)) {
-		return;  // ARGB
+	if (ycbcr_source_format(srcframe, hshift, vshift, full_range)) {
+		if (srcframe->data[1] == nullptr || srcframe->data[2] == nullptr) { return false; }
+	} else if (srcframe->format != AV_PIX_FMT_BGRA || srcframe->linesize[0] < (srcframe->width * 4)) {
+		return false;  // ARGB
 	}
-	if (dstframe->width != srcframe->width) { return; }
-	if (dstframe->height != srcframe->height) { return; }
+	if (dstframe->width != srcframe->width) { return false; }
+	if (dstframe->height != srcframe->height) { return false; }
 
 	if (srcframe->interlaced_frame != 0) {
 		opposite = (srcframe->top_field_first != 0 ? 1 : 0);
@@ -1566,387 +4508,525 @@ void composite_layer(
 		opposite = 0;
 	}
 
-	fY = new int[dstframe_pixels]{0};
-	fI = new int[dstframe_pixels]{0};
-	fQ = new int[dstframe_pixels]{0};
+	if (!ctx.arena.allocplanes(dstframe->width, dstframe->height)) { return false; }
+
+	if (video_measure_int16) {
+		composite_kernels.measure(dstframe, srcframe, ctx.arena, opposite, field, fieldno);
+		return true;
+	}
 
-	for (auto row = field; row < dstframe->height; row += 2) {
-		for (auto col = 0; col < dstframe->width; col++) {
-			/*Getting the pixel location is a bit complicated, because each line from srcframe->data[0] has padding
-			 * added to it. We have to use `linesize` to get how many bytes each line actually takes up and index into
-			 * the pixel buffer with that.*/
-			auto pixel = reinterpret_cast<uint8_t*>(
-							 srcframe->data[0] +	   // start of pixel buffer
-							 (srcframe->linesize[0] *  // size of row of pixels, including padding
-								 std::min(row + opposite, static_cast<unsigned int>(dstframe->height) - 1U))) +
-						 (col * 4);  // There are 4 1-byte colors per pixel
+	FrontCache front;
 
-			// Colors in srcframe are actually BGRA
-			b = pixel[0];
-			g = pixel[1];
-			r = pixel[2];
+	if (source_cache && composite_in_chroma_lowpass) {
+		front = ctx.sources.lookup(&inputfile, field, reinterpret_cast<uintptr_t>(srcframe->opaque),
+			dstframe->width, dstframe->height);
+	}
 
-			auto idx = (row * dstframe->width) + col;
-			RGB_to_YIQ(fY[idx], fI[idx], fQ[idx], r, g, b);
+	// one parallel region per field. composite_field() splits the strips of the field across the OpenMP team
+	// (which is persistent, so this does not create threads per field) with orphaned "omp for" loops.
+	// the implied barrier at the end of each loop keeps the stages in order. (with -fields > 1 this is nested in
+	// the field's task and runs on that one thread.)
+#pragma omp parallel
+	{
+		if (video_work_format == WORK_INT16) {
+			composite_kernels.field16(dstframe, srcframe, ctx.arena.planes16, front, opposite, field, fieldno);
+		} else {
+			composite_kernels.field(dstframe, srcframe, ctx.arena.planes, front, opposite, field, fieldno);
 		}
 	}
+	return true;
+}
 
-	if (composite_in_chroma_lowpass) { composite_lowpass(dstframe, fY, fI, fQ, field, fieldno); }
+// the render pipeline. every stage runs on a thread of its own and hands its work to the next one through an
+// SPSCRing of -pipeline-depth entries, so the output rate is that of the slowest stage, not the sum of them all:
+//
+//   main       demux, decode, audio ----------------------------------------+
+//   scale      decoded frame -> BGRA at the output size (frame_copy_scale)   |  (Y'CbCr at that size is passed on)
+//   composite  composite_layer() straight into the codec's YUV444P frame    | audio packets
+//   encode     avcodec_send_frame/avcodec_receive_packet                     v
+//   mux        av_interleaved_write_frame, video and audio alike
+//
+// the codec frames come from a fixed pool and go back upstream on the "free" ring once the encoder is done with
+// them. the free ring holds the whole pool, so returning a frame never blocks.
+class FieldJob
+{
+public:
+	unsigned long long	field{0};
+	std::vector<AVFrame*> decoded;  // per input file: new frame to scale, nullptr if unchanged since the last field
+	std::vector<AVFrame*> source;   // per input file: reference to the frame to composite (BGRA or Y'CbCr)
+	bool				  encode{true};  // false: lead-in of a slice, only rendered into the render targets
+};
 
-	chroma_into_luma(dstframe, fY, fI, fQ, field, fieldno, subcarrier_amplitude);
+// a field in flight in the composite stage
+class FieldSlot
+{
+public:
+	FieldJob*				job{nullptr};
+	AVFrame*				out{nullptr};  // from the encode pool
+	CompositeRenderContext* ctx{nullptr};  // working planes, one set per slot
+	bool					drawn{false};  // any layer drawn at all
+	std::atomic<bool>		done{false};
+};
 
-	/* video composite preemphasis */
-	if (composite_preemphasis != 0 && composite_preemphasis_cut > 0) {
-		for (auto y = field; y < dstframe->height; y += 2) {
-			int*		  Y = fY + (y * dstframe->width);
-			LowpassFilter pre;
-			float		  s;
+class RenderPipeline
+{
+public:
+	explicit RenderPipeline(const size_t depth, const size_t fields)
+		: to_scale(depth), to_composite(depth), to_encode(depth), to_mux(depth * 4), audio_to_mux(depth * 16),
+		  encode_free(output_avstream_video_encode_pool.size()), field_slots(fields), field_contexts(fields - 1) {
+		field_slots[0].ctx = &composite_render_context;
+		for (size_t i = 1; i < fields; i++) { field_slots[i].ctx = &field_contexts[i - 1]; }
+	}
 
-			pre.setFilter(
-				(315000000.00F * 4.F) / 88.F, composite_preemphasis_cut);  // 315/88 Mhz rate * 4  vs 1.0MHz cutoff
-			pre.resetFilter(16.F);
-			for (auto x = 0; x < dstframe->width; x++) {
-				s = Y[x];
-				s += pre.highpass(s) * composite_preemphasis;
-				Y[x] = static_cast<int>(s);
-			}
+	void start() {
+		for (auto* f : output_avstream_video_encode_pool) { encode_free.push(f); }
+
+		scale_thread	 = std::thread(&RenderPipeline::scale_stage, this);
+		composite_thread = std::thread(&RenderPipeline::composite_stage, this);
+		encode_thread	= std::thread(&RenderPipeline::encode_stage, this);
+		mux_thread	   = std::thread(&RenderPipeline::mux_stage, this);
+	}
+	void submit(FieldJob* job) { to_scale.push(job); }
+	void submit_audio(AVPacket* pkt) { audio_to_mux.push(pkt); }
+	// no more fields or audio. returns once everything in flight has been written out, encoder delay included.
+	void finish() {
+		to_scale.close();
+		audio_to_mux.close();
+		for (auto* t : {&scale_thread, &composite_thread, &encode_thread, &mux_thread}) {
+			if (t->joinable()) { t->join(); }
 		}
 	}
 
-	/* add video noise */
-	if (video_noise != 0) {
-		int noise	 = 0;
-		int noise_mod = (video_noise * 2) + 1; /* ,noise_mod = (video_noise * 255) / 100; */
+private:
+	void scale_stage() {
+		FieldJob* job;
 
-		for (auto y = field; y < dstframe->height; y += 2) {
-			int* Y = fY + (y * dstframe->width);
+		while (to_scale.pop(job)) {
+			job->source.assign(input_files.size(), nullptr);
+			for (size_t i = 0; i < input_files.size(); i++) {
+				InputFile& fin = input_files[i];
 
-			for (auto x = 0; x < dstframe->width; x++) {
-				Y[x] += noise;
-				noise += (static_cast<int>(static_cast<unsigned int>(rand()) % noise_mod)) - video_noise;
-				noise /= 2;
+				if (job->decoded[i] != nullptr) {
+					fin.frame_copy_scale(job->decoded[i]);
+					av_frame_free(&job->decoded[i]);
+				}
+				if (fin.input_avstream_video_frame_rgb != nullptr) {
+					job->source[i] = av_frame_clone(fin.input_avstream_video_frame_rgb);
+				}
 			}
+			to_composite.push(job);
 		}
+		to_composite.close();
 	}
+	// with -fields n, up to n fields are rendered at once, each as an OpenMP task on a team of its own (the
+	// parallel region in composite_layer() is then inactive, one thread per field). a field only writes the
+	// scanlines of its own parity, so every field in flight renders into a codec frame of its own, and the fields
+	// are woven into the render targets here, in order, on the way out.
+	void composite_stage() {
+		const unsigned int window = static_cast<unsigned int>(field_slots.size());
+
+#ifdef _OPENMP
+		// the thread count is a per-thread setting, and this is the thread that opens the parallel regions
+		if (video_threads > 0) { omp_set_num_threads(video_threads); }
+		if (window > 1) { omp_set_max_active_levels(1); }
+#endif
 
-	// VHS head switching noise
-	if (vhs_head_switching) {
-		unsigned int twidth = dstframe->width + (dstframe->width / 10);
-		unsigned int tx;
-		unsigned int x;
-		unsigned int p;
-		unsigned int x2;
-		unsigned int shy   = 0;
-		float		 noise = 0.F;
-		int			 shif;
-		int			 ishif;
-		int			 y;
-		float		 t;
-
-		if (vhs_head_switching_phase_noise != 0) {
-			unsigned int x = static_cast<unsigned int>(rand()) * static_cast<unsigned int>(rand()) *
-							 static_cast<unsigned int>(rand()) * static_cast<unsigned int>(rand());
-			x %= 2000000000U;
-			noise = (static_cast<float>(x) / 1000000000U) - 1.0F;
-			noise *= vhs_head_switching_phase_noise;
-		}
-
-		if (output_ntsc) {
-			t = twidth * 262.5F;
+		if (window > 1) {
+			// one more than the number of fields: the thread running the single block hands out the fields and
+			// spends most of its time waiting on the rings
+#pragma omp parallel num_threads(window + 1)
+#pragma omp single
+			composite_fields();
 		} else {
-			t = twidth * 312.5F;
+			composite_fields();
 		}
+		to_encode.close();
+	}
+	void composite_fields() {
+		const unsigned long long window	= field_slots.size();
+		unsigned long long		 issued	= 0;
+		unsigned long long		 assembled = 0;
+		AVFrame*				 out	   = nullptr;
+		FieldJob*				 job;
+
+		while (to_composite.pop(job)) {
+			// pass on the fields that are done, in order. if the window is full, wait for the oldest
+			while (assembled < issued) {
+				FieldSlot&   oldest = field_slots[assembled % window];
+				unsigned int spins  = 0;
+
+				if ((issued - assembled) < window && !oldest.done.load(std::memory_order_acquire)) { break; }
+				while (!oldest.done.load(std::memory_order_acquire)) { SPSCRing<FieldJob*>::backoff(spins); }
+				weave_field(oldest);
+				assembled++;
+			}
 
-		p = static_cast<unsigned int>(fmod(vhs_head_switching_point + noise, 1.0F) * t);
-		y = ((p / twidth) * 2) + field;
+			// the planes come from the AVBufferPool. a frame still held by the encoder keeps its own
+			if (out == nullptr && !spare.empty()) {
+				out = spare.back();
+				spare.pop_back();
+			}
+			if (out == nullptr) { encode_free.pop(out); }
+			if (!output_avstream_video_encode_buffers.get(out)) {
+				fprintf(stderr, "Failed to alloc encode frame\n");
+				for (auto*& f : job->source) {
+					if (f != nullptr) { av_frame_free(&f); }
+				}
+				delete job;
+				continue;
+			}
+			av_frame_set_colorspace(out, AVCOL_SPC_SMPTE170M);
+			av_frame_set_color_range(out, AVCOL_RANGE_MPEG);
 
-		p = static_cast<unsigned int>(fmod(vhs_head_switching_phase + noise, 1.0F) * t);
-		x = p % twidth;
+			FieldSlot* slot = &field_slots[issued % window];
 
-		if (output_ntsc) {
-			y -= (262 - 240) * 2;
-		} else {
-			y -= (312 - 288) * 2;
-		}
+			slot->job = job;
+			slot->out = out;
+			slot->done.store(false, std::memory_order_relaxed);
+			out = nullptr;
+			issued++;
 
-		tx = x;
-		if (x >= (twidth / 2)) {
-			ishif = x - twidth;
-		} else {
-			ishif = x;
+			if (window > 1) {
+#pragma omp task firstprivate(slot)
+				render_field(*slot);
+			} else {
+				render_field(*slot);
+			}
 		}
 
-		shif = 0;
-		while (y < dstframe->height) {
-			if (y >= 0) {
-				int* Y = fY + (y * dstframe->width);
+		while (assembled < issued) {
+			FieldSlot&   oldest = field_slots[assembled % window];
+			unsigned int spins  = 0;
 
-				if (shif != 0) {
-					int tmp[twidth];
+			while (!oldest.done.load(std::memory_order_acquire)) { SPSCRing<FieldJob*>::backoff(spins); }
+			weave_field(oldest);
+			assembled++;
+		}
+		if (held != nullptr) { to_encode.push(held); }  // -vi: the last frame only got its first field
+		held = nullptr;
+	}
+	void render_field(FieldSlot& slot) {
+		FieldJob* job = slot.job;
 
-					/* WARNING: This is not 100% accurate. On real VHS you'd see the line shifted over and the next
-					 * line's contents after hsync. */
+		slot.drawn = false;
+		for (size_t i = 0; i < input_files.size(); i++) {
+			// composite the layer, keying against the color. all code assumes ARGB
+			const unsigned int field = (job->field & 1) ^ 1;
 
-					/* luma. the chroma subcarrier is there, so this is all we have to do. */
-					x2 = (tx + twidth + static_cast<unsigned int>(shif)) % twidth;
-					memset(tmp, 0, sizeof(tmp));
-					memcpy(tmp, Y, dstframe->width * sizeof(int));
-					for (x = tx; x < dstframe->width; x++) {
-						Y[x] = tmp[x2];
-						if ((++x2) == twidth) { x2 = 0; }
-					}
+			if (composite_layer(*slot.ctx, slot.out, job->source[i], input_files[i], field, job->field)) {
+				slot.drawn = true;
+			}
+			if (job->source[i] != nullptr) { av_frame_free(&job->source[i]); }
+		}
+		slot.done.store(true, std::memory_order_release);
+	}
+	// merge the field with the render target it belongs to, which carries the other field (and, with -d, what
+	// was there before), and pass it on
+	void weave_field(FieldSlot& slot) {
+		AVFrame*		   target = output_avstream_video_frame[output_avstream_video_frame_index];
+		AVFrame*		   out	= slot.out;
+		const unsigned int field  = (slot.job->field & 1) ^ 1;
+
+		for (int y = 0; y < target->height; y++) {
+			const bool drawn = slot.drawn && (static_cast<unsigned int>(y) & 1U) == field;
+
+			for (unsigned int c = 0; c < 3; c++) {
+				uint8_t* t = target->data[c] + (target->linesize[c] * y);
+				uint8_t* o = out->data[c] + (out->linesize[c] * y);
+
+				if (drawn) {
+					memcpy(t, o, target->width);
+				} else {
+					memcpy(o, t, target->width);
 				}
 			}
+		}
 
-			if (shy == 0) {
-				shif = ishif;
-			} else {
-				shif = (shif * 7) / 8;
+		// field deinterlace
+		/*{
+			unsigned int sy;
+			unsigned int dy;
+			unsigned int y;
+
+			if (field != 0u) {
+				for (y = field; y < target->height; y += 2) {
+					auto* d = reinterpret_cast<uint32_t*>(target->data[0] + (target->linesize[0] * (y - 1)));
+					auto* s = reinterpret_cast<uint32_t*>(target->data[0] + (target->linesize[0] * y));
+
+					memcpy(d, s, sizeof(uint32_t) * target->width);
+				}
+			} else {  // field == 0
+				for (y = 1; (y + 1) < target->height; y += 2) {
+					auto* d = reinterpret_cast<uint32_t*>(target->data[0] + (target->linesize[0] * y));
+					auto* s = reinterpret_cast<uint32_t*>(target->data[0] + (target->linesize[0] * (y + 1)));
+
+					memcpy(d, s, sizeof(uint32_t) * target->width);
+				}
 			}
+		}*/
 
-			tx = 0;
-			y += 2;
-			shy++;
+		assert(output_avstream_video_frame_index < output_avstream_video_frame.size());
+		if ((++output_avstream_video_frame_index) >= output_avstream_video_frame_delay) {
+			output_avstream_video_frame_index = 0;
 		}
-	}
 
-	if (!nocolor_subcarrier) { chroma_from_luma(dstframe, fY, fI, fQ, field, fieldno, subcarrier_amplitude_back); }
+		out->pts			  = slot.job->field;
+		out->pkt_pts		  = target->pkt_pts;
+		out->pkt_dts		  = target->pkt_dts;
+		out->top_field_first  = target->top_field_first;
+		out->interlaced_frame = target->interlaced_frame;
+
+		const bool encode = slot.job->encode;
+
+		delete slot.job;
+		slot.job = nullptr;
+		slot.out = nullptr;
+		if (!encode) {
+			av_frame_unref(out);
+			spare.push_back(out);
+			return;
+		}
+		if (!output_video_as_interlaced) {
+			to_encode.push(out);
+			return;
+		}
 
-	/* add video noise */
-	if (video_chroma_noise != 0) {
-		int noiseU	= 0;
-		int noiseV	= 0;
-		int noise_mod = (video_chroma_noise * 255) / 100;
-
-		for (auto y = field; y < dstframe->height; y += 2) {
-			int* U = fI + (y * dstframe->width);
-			int* V = fQ + (y * dstframe->width);
-
-			for (auto x = 0; x < dstframe->width; x++) {
-				U[x] += noiseU;
-				V[x] += noiseV;
-				noiseU += (static_cast<int>(static_cast<unsigned int>(rand()) % ((video_chroma_noise * 2) + 1))) -
-						  video_chroma_noise;
-				noiseU /= 2;
-				noiseV += (static_cast<int>(static_cast<unsigned int>(rand()) % ((video_chroma_noise * 2) + 1))) -
-						  video_chroma_noise;
-				noiseV /= 2;
+		// -vi: the fields of frame n are 2n (bottom) and 2n + 1 (top). every field comes out of here woven with the
+		// other one, so only the second of the pair needs encoding. the first is held back until then, in case the
+		// render ends on it
+		if ((out->pts & 1) == 0) {
+			if (held != nullptr) { to_encode.push(held); }
+			held = out;
+		} else {
+			if (held != nullptr) {
+				av_frame_unref(held);
+				spare.push_back(held);
 			}
+			held = nullptr;
+			to_encode.push(out);
 		}
 	}
-	if (video_chroma_phase_noise != 0) {
-		int   noise		= 0;
-		int   noise_mod = (video_chroma_noise * 255) / 100;
-		float pi;
-		float u;
-		float v;
-		float u_;
-		float v_;
-		float sinpi;
-		float cospi;
-
-		for (auto y = field; y < dstframe->height; y += 2) {
-			int* U = fI + (y * dstframe->width);
-			int* V = fQ + (y * dstframe->width);
-
-			noise += (static_cast<int>(static_cast<unsigned int>(rand()) % ((video_chroma_phase_noise * 2) + 1))) -
-					 video_chroma_phase_noise;
-			noise /= 2;
-			pi = (static_cast<float>(noise) * M_PI) / 100.F;
-
-			sinpi = sin(pi);
-			cospi = cos(pi);
+	void encode_stage() {
+		AVFrame* frame;
+
+		while (to_encode.pop(frame)) {
+			encode_field(frame, static_cast<unsigned long long>(frame->pts));
+			// the encoder holds its own reference if it still needs the picture. the planes go back to the pool
+			// when it lets go, and the frame goes back for the next field now
+			av_frame_unref(frame);
+			encode_free.push(frame);
+		}
 
-			for (auto x = 0; x < dstframe->width; x++) {
-				u = U[x];  // think of 'u' as x-coord
-				v = V[x];  // and 'v' as y-coord
+		/* flush encoder delay */
+		encode_field(nullptr, 0);
+		to_mux.close();
+	}
+	// encode one field (or, with frame == nullptr, drain the encoder) and pass on every packet that is ready
+	void encode_field(AVFrame* frame, unsigned long long field_number) {
+		if (frame != nullptr) {
+			// the output of a slice (-ss, -segment) starts at 0, with a key frame
+			const unsigned long long n = field_number - segment_first_field;
+
+			if (output_video_as_interlaced) {
+				frame->key_frame		= ((n / 2ULL) % 15ULL) == 0 ? 1 : 0;
+				frame->interlaced_frame = 1;
+				frame->top_field_first  = 0;
+				frame->pts				= n / 2ULL;
+			} else {
+				frame->key_frame		= (n % (15ULL * 2ULL)) == 0 ? 1 : 0;
+				frame->interlaced_frame = 0;
+				frame->pts				= n;
+			}
 
-				// then this 2D rotation then makes more sense
-				u_ = (u * cospi) - (v * sinpi);
-				v_ = (u * sinpi) + (v * cospi);
+			fprintf(stderr,
+				"\x0D"
+				"Output field %llu ",
+				field_number);
+			fflush(stderr);
 
-				// put it back
-				U[x] = u_;
-				V[x] = v_;
+			// an encoder that does not take YUV444P gets a converted copy
+			if (output_avstream_video_encode_convert.active() &&
+				(frame = output_avstream_video_encode_convert.convert(frame)) == nullptr) {
+				fprintf(stderr, "Failed to convert field %llu\n", field_number);
+				return;
 			}
 		}
-	}
 
-	// NTS: At this point, the video best resembles what you'd get from a typical DVD player's composite video output.
-	//      Slightly blurry, some color artifacts, and edges will have that "buzz" effect, but still a good picture.
+		if (avcodec_send_frame(output_avstream_video_codec_context, frame) < 0) {
+			fprintf(stderr, "Failed to encode video\n");
+			return;
+		}
 
-	if (emulating_vhs) {
-		float luma_cut;
-		float chroma_cut;
-		int   chroma_delay;
-
-		switch (output_vhs_tape_speed) {
-			case VHS_SP:
-				luma_cut	 = 2400000.F;  // 3.0MHz x 80%
-				chroma_cut   = 320000.F;   // 400KHz x 80%
-				chroma_delay = 9;
-				break;
-			case VHS_LP:
-				luma_cut	 = 1900000.F;  // ..
-				chroma_cut   = 300000.F;   // 375KHz x 80%
-				chroma_delay = 12;
-				break;
-			case VHS_EP:
-				luma_cut	 = 1400000.F;  // ..
-				chroma_cut   = 280000.F;   // 350KHz x 80%
-				chroma_delay = 14;
-				break;
-			default: abort();
-		};
+		// the muxer frees every packet it is given, so each one that comes out needs its own
+		AVPacket* pkt = av_packet_alloc();
 
-		// luma lowpass
-		for (auto y = field; y < dstframe->height; y += 2) {
-			int*		  Y = fY + (y * dstframe->width);
-			LowpassFilter lp[3];
-			LowpassFilter pre;
-			float		  s;
+		while (pkt != nullptr && avcodec_receive_packet(output_avstream_video_codec_context, pkt) >= 0) {
+			pkt->stream_index = output_avstream_video->index;
+			av_packet_rescale_ts(pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
+			to_mux.push(pkt);
+			pkt = av_packet_alloc();
+		}
 
-			for (auto& f : lp) {
-				f.setFilter((315000000.00F * 4.F) / 88.F, luma_cut);  // 315/88 Mhz rate * 4  vs 3.0MHz cutoff
-				f.resetFilter(16);
-			}
-			pre.setFilter((315000000.00F * 4.F) / 88.F, luma_cut);  // 315/88 Mhz rate * 4  vs 1.0MHz cutoff
-			pre.resetFilter(16.F);
-			for (auto x = 0; x < dstframe->width; x++) {
-				s = Y[x];
-				for (auto& f : lp) { s = f.lowpass(s); }
-				s += pre.highpass(s) * 1.6F;
-				Y[x] = s;
-			}
+		if (pkt == nullptr) {
+			fprintf(stderr, "Failed to alloc vid packet\n");
+		} else {
+			av_packet_free(&pkt);
 		}
+	}
+	void mux_stage() {
+		unsigned int spins = 0;
+		AVPacket*	pkt;
 
-		// chroma lowpass
-		for (auto y = field; y < dstframe->height; y += 2) {
-			int*		  U = fI + (y * dstframe->width);
-			int*		  V = fQ + (y * dstframe->width);
-			LowpassFilter lpU[3];
-			LowpassFilter lpV[3];
-			float		  s;
-
-			for (unsigned int f = 0; f < 3; f++) {
-				lpU[f].setFilter((315000000.00F * 4.F) / 88.F,
-					chroma_cut);  // 315/88 Mhz rate * 4 (divide by 2 for 4:2:2) vs 400KHz cutoff
-				lpU[f].resetFilter(0);
-				lpV[f].setFilter((315000000.00F * 4.F) / 88.F,
-					chroma_cut);  // 315/88 Mhz rate * 4 (divide by 2 for 4:2:2) vs 400KHz cutoff
-				lpV[f].resetFilter(0.F);
-			}
-			for (auto x = 0; x < dstframe->width; x++) {
-				s = U[x];
-				for (auto& f : lpU) { s = f.lowpass(s); }
-				if (x >= chroma_delay) { U[x - chroma_delay] = s; }
-
-				s = V[x];
-				for (auto& f : lpV) { s = f.lowpass(s); }
-				if (x >= chroma_delay) { V[x - chroma_delay] = s; }
-			}
-		}
-
-		// VHS decks also vertically smear the chroma subcarrier using a delay line
-		// to add the previous line's color subcarrier to the current line's color subcarrier.
-		// note that phase changes in NTSC are compensated for by the VHS deck to make the
-		// phase line up per scanline (else summing the previous line's carrier would
-		// cancel it out).
-		if (vhs_chroma_vert_blend && output_ntsc) {
-			int delayU[dstframe->width];
-			int delayV[dstframe->width];
-
-			memset(delayU, 0, dstframe->width * sizeof(int));
-			memset(delayV, 0, dstframe->width * sizeof(int));
-			for (auto y = (field + 2); y < dstframe->height; y += 2) {
-				int* U = fI + (y * dstframe->width);
-				int* V = fQ + (y * dstframe->width);
-				int  cU;
-				int  cV;
-
-				for (auto x = 0; x < dstframe->width; x++) {
-					cU		  = U[x];
-					cV		  = V[x];
-					U[x]	  = (delayU[x] + cU + 1) >> 1;
-					V[x]	  = (delayV[x] + cV + 1) >> 1;
-					delayU[x] = cU;
-					delayV[x] = cV;
+		while (!(to_mux.done() && audio_to_mux.done())) {
+			bool got = false;
+
+			if (to_mux.try_pop(pkt)) {
+				if (av_interleaved_write_frame(output_avfmt, pkt) < 0) {
+					fprintf(stderr, "AV write frame failed video\n");
 				}
+				av_packet_free(&pkt);
+				got = true;
+			}
+			if (audio_to_mux.try_pop(pkt)) {
+				if (av_interleaved_write_frame(output_avfmt, pkt) < 0) { fprintf(stderr, "Failed to write frame\n"); }
+				av_packet_free(&pkt);
+				got = true;
 			}
-		}
 
-		// VHS decks tend to sharpen the picture on playback
-		if (true /*TODO make option*/) {
-			// luma
-			for (auto y = field; y < dstframe->height; y += 2) {
-				int*		  Y = fY + (y * dstframe->width);
-				LowpassFilter lp[3];
-				float		  s;
-				float		  ts;
-
-				for (auto& f : lp) {
-					f.setFilter((315000000.00F * 4.F) / 88.F, luma_cut * 4.F);  // 315/88 Mhz rate * 4  vs 3.0MHz cutoff
-					f.resetFilter(0.F);
-				}
-				for (auto x = 0; x < dstframe->width; x++) {
-					s = ts = Y[x];
-					for (auto& f : lp) { ts = f.lowpass(ts); }
-					Y[x] = s + ((s - ts) * vhs_out_sharpen * 2);
-				}
+			if (got) {
+				spins = 0;
+			} else {
+				SPSCRing<AVPacket*>::backoff(spins);
 			}
 		}
+	}
 
-		if (!vhs_svideo_out) {
-			chroma_into_luma(dstframe, fY, fI, fQ, field, fieldno, subcarrier_amplitude);
-			chroma_from_luma(dstframe, fY, fI, fQ, field, fieldno, subcarrier_amplitude);
-		}
+private:
+	SPSCRing<FieldJob*>					to_scale;
+	SPSCRing<FieldJob*>					to_composite;
+	SPSCRing<AVFrame*>					to_encode;
+	SPSCRing<AVPacket*>					to_mux;
+	SPSCRing<AVPacket*>					audio_to_mux;
+	SPSCRing<AVFrame*>					encode_free;
+	std::vector<FieldSlot>				field_slots;
+	std::vector<CompositeRenderContext> field_contexts;  // for field_slots[1...]
+	AVFrame*							held{nullptr};   // -vi: first field of the frame being woven
+	std::vector<AVFrame*>				spare;		   // frames never sent to the encoder, to reuse
+	std::thread							scale_thread;
+	std::thread							composite_thread;
+	std::thread							encode_thread;
+	std::thread							mux_thread;
+};
+
+RenderPipeline* render_pipeline = nullptr;
+
+// write_out_audio() runs on the main thread, the muxer on its own
+void mux_audio_packet(AVPacket& pkt) {
+	AVPacket* p = av_packet_alloc();
+
+	if (p == nullptr) {
+		av_packet_unref(&pkt);
+		return;
 	}
+	av_packet_move_ref(p, &pkt);
+	render_pipeline->submit_audio(p);
+}
 
-	if (video_chroma_loss != 0) {
-		for (auto y = field; y < dstframe->height; y += 2) {
-			int* U = fI + (y * dstframe->width);
-			int* V = fQ + (y * dstframe->width);
+// field and audio sample range of -ss/-se/-t or -segment K/N
+static bool segment_setup() {
+	const AVRational field_tb = {output_field_rate.den, output_field_rate.num};
 
-			if (((static_cast<unsigned int>(rand())) % 100000) < video_chroma_loss) {
-				memset(U, 0, dstframe->width * sizeof(int));
-				memset(V, 0, dstframe->width * sizeof(int));
-			}
+	if (segment_count != 0) {
+		if (input_files.empty() || input_files[0].input_avfmt == nullptr ||
+			input_files[0].input_avfmt->duration == AV_NOPTS_VALUE || input_files[0].input_avfmt->duration <= 0) {
+			fprintf(stderr, "-segment needs the length of the first input, which is unknown. Use -ss/-t\n");
+			return false;
 		}
-	}
 
-	if (composite_out_chroma_lowpass) {
-		if (composite_out_chroma_lowpass_lite) {
-			composite_lowpass_tv(dstframe, fY, fI, fQ, field, fieldno);
-		} else {
-			composite_lowpass(dstframe, fY, fI, fQ, field, fieldno);
+		const unsigned long long total = av_rescale_q(input_files[0].input_avfmt->duration, AV_TIME_BASE_Q, field_tb);
+
+		segment_first_field = (total * (segment_index - 1)) / segment_count;
+		// the last part runs to the end, whatever the container claimed the length to be
+		segment_end_field = segment_index < segment_count ? (total * segment_index) / segment_count : ULLONG_MAX;
+	} else {
+		segment_first_field = llround(segment_ss / av_q2d(field_tb));
+		if (segment_t >= 0) {
+			segment_end_field = segment_first_field + llround(segment_t / av_q2d(field_tb));
+		} else if (segment_se >= 0) {
+			segment_end_field = llround(segment_se / av_q2d(field_tb));
 		}
 	}
 
-	for (auto y = field; y < dstframe->height; y += 2) {
-		auto dscan = reinterpret_cast<uint32_t*>(dstframe->data[0] + (dstframe->linesize[0] * y));
-		for (auto x = 0; x < dstframe->width; x++, dscan++) {
-			auto idx = (y * dstframe->width) + x;
-			int  r, g, b;
-			YIQ_to_RGB(r, g, b, fY[idx], fI[idx], fQ[idx]);
-			*dscan = (r << 16) + (g << 8) + b;
-		}
+	// -vi: a part starts and ends on a frame boundary, so the parts still pair up the same fields
+	if (output_video_as_interlaced) {
+		segment_first_field &= ~1ULL;
+		if (segment_end_field != ULLONG_MAX) { segment_end_field &= ~1ULL; }
+	}
+
+	if (segment_end_field <= segment_first_field) {
+		fprintf(stderr, "Nothing to render\n");
+		return false;
+	}
+
+	// the lines a field does not draw come from the render target it is woven into, last drawn -d fields ago
+	const unsigned long long lead_in = output_avstream_video_frame_delay + 1;
+
+	segment_lead_field = segment_first_field > lead_in ? segment_first_field - lead_in : 0;
+
+	// field n starts at sample n * rate / field rate. the next part starts where this one ends, to the sample
+	segment_first_sample = av_rescale(segment_first_field, static_cast<int64_t>(output_audio_rate) * field_tb.num,
+		field_tb.den);
+	if (segment_end_field != ULLONG_MAX) {
+		segment_end_sample = av_rescale(segment_end_field, static_cast<int64_t>(output_audio_rate) * field_tb.num,
+			field_tb.den);
+		fprintf(stderr, "Rendering fields %llu-%llu\n", segment_first_field, segment_end_field - 1);
+	} else if (segment_first_field != 0) {
+		fprintf(stderr, "Rendering fields %llu-\n", segment_first_field);
 	}
 
-	delete[] fY;
-	delete[] fI;
-	delete[] fQ;
+	return true;
 }
 
-int main(int argc, char** argv) {
-	std::thread EncoderThread([]() {
-		for (auto& params : *EncoderChannel) {
-			auto& [p1, p2] = params;
-			output_frame(p1, p2);
-		}
-	});
+static bool segment_rendering() { return segment_first_field != 0 || segment_end_field != ULLONG_MAX; }
+
+// the ffconcat entry for this part. the parts of a job concatenated in order make up the list for the concat
+// demuxer, which is why there is no "ffconcat version 1.0" header (it may only be the first line of the list)
+static void write_segment_manifest(unsigned long long fields) {
+	const AVRational  field_tb = {output_field_rate.den, output_field_rate.num};
+	const std::string path	 = segment_manifest.empty() ? (output_file + ".ffconcat") : segment_manifest;
+	const size_t	  slash	= output_file.find_last_of('/');
+	std::string		  name	 = slash != std::string::npos ? output_file.substr(slash + 1) : output_file;
+	FILE*			  fp;
+
+	// ffconcat quoting: ' becomes '\''
+	for (size_t i = 0; (i = name.find('\'', i)) != std::string::npos; i += 4) { name.replace(i, 1, "'\\''"); }
+
+	if ((fp = fopen(path.c_str(), "w")) == nullptr) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		return;
+	}
+	fprintf(fp, "# fields %llu-%llu", segment_first_field, segment_first_field + fields - 1);
+	if (audio_written_to > segment_first_sample) {
+		fprintf(fp, ", audio samples %llu-%llu", segment_first_sample,
+			std::min(audio_written_to, segment_end_sample) - 1);
+	}
+	fprintf(fp, "\n");
+	fprintf(fp, "file '%s'\n", name.c_str());
+	fprintf(fp, "duration %.6f\n", fields * av_q2d(field_tb));
+	fclose(fp);
+}
 
+int main(int argc, char** argv) {
 	preset_NTSC();
 	if (parse_argv(argc, argv) != 0) { return 1; }
+	if (test_kernels) { return test_simd_kernels() ? 0 : 1; }
+	select_simd_kernels();
+	select_composite_kernels();
+	composite_filters.init();
+#ifdef _OPENMP
+	if (video_threads > 0) { omp_set_num_threads(video_threads); }
+	fprintf(stderr, "Rendering with %d thread(s)\n", omp_get_max_threads());
+#endif
 
 	av_register_all();
 	avformat_network_init();
@@ -1960,6 +5040,8 @@ int main(int argc, char** argv) {
 		}
 	}
 
+	if (!segment_setup()) { return 1; }
+
 	/* open output file */
 	assert(output_avfmt == nullptr);
 	if (avformat_alloc_output_context2(&output_avfmt, nullptr, nullptr, output_file.c_str()) < 0) {
@@ -2016,25 +5098,75 @@ int main(int argc, char** argv) {
 			return 1;
 		}
 
-		avcodec_get_context_defaults3(output_avstream_video_codec_context, avcodec_find_encoder(AV_CODEC_ID_H264));
+		const AVCodec* codec = avcodec_find_encoder_by_name(output_video_encoder.codec.c_str());
+		AVDictionary*  codec_opts = nullptr;
+
+		if (codec == nullptr || codec->type != AVMEDIA_TYPE_VIDEO) {
+			fprintf(stderr, "Unknown video encoder '%s'\n", output_video_encoder.codec.c_str());
+			return 1;
+		}
+
+		avcodec_get_context_defaults3(output_avstream_video_codec_context, codec);
 		output_avstream_video_codec_context->width				 = output_width;
 		output_avstream_video_codec_context->height				 = output_height;
 		output_avstream_video_codec_context->sample_aspect_ratio = output_aspect_ratio;
-		output_avstream_video_codec_context->pix_fmt			 = AV_PIX_FMT_YUV444P;
-		av_opt_set_int(output_avstream_video_codec_context, "crf", 0, AV_OPT_SEARCH_CHILDREN);
-		av_opt_set(output_avstream_video_codec_context, "preset", "ultrafast", AV_OPT_SEARCH_CHILDREN);
-		av_opt_set(output_avstream_video_codec_context, "tune", "zerolatency", AV_OPT_SEARCH_CHILDREN);
-		output_avstream_video_codec_context->time_base = (AVRational){output_field_rate.den, output_field_rate.num};
+		output_avstream_video_codec_context->pix_fmt			 = encoder_pix_fmt(codec);
+		if (output_avstream_video_codec_context->pix_fmt == AV_PIX_FMT_NONE) { return 1; }
+		output_avstream_video_codec_context->thread_count = output_video_encoder.threads;
+		if (output_video_encoder.thread_type != 0) {
+			output_avstream_video_codec_context->thread_type = output_video_encoder.thread_type;
+		}
+		if (output_video_encoder.bitrate > 0) {
+			output_avstream_video_codec_context->bit_rate = output_video_encoder.bitrate;
+		} else if (output_video_encoder.crf >= 0) {
+			av_opt_set_int(
+				output_avstream_video_codec_context, "crf", output_video_encoder.crf, AV_OPT_SEARCH_CHILDREN);
+		}
+		if (!output_video_encoder.preset.empty()) {
+			av_opt_set(output_avstream_video_codec_context, "preset", output_video_encoder.preset.c_str(),
+				AV_OPT_SEARCH_CHILDREN);
+		}
+		if (!output_video_encoder.tune.empty()) {
+			av_opt_set(output_avstream_video_codec_context, "tune", output_video_encoder.tune.c_str(),
+				AV_OPT_SEARCH_CHILDREN);
+		}
+		if (!output_video_encoder.options.empty() &&
+			av_dict_parse_string(&codec_opts, output_video_encoder.options.c_str(), "=", ":", 0) < 0) {
+			fprintf(stderr, "Invalid encoder options '%s'\n", output_video_encoder.options.c_str());
+			return 1;
+		}
+		if (output_video_as_interlaced) {
+			output_avstream_video_codec_context->time_base =
+				(AVRational){output_field_rate.den, (output_field_rate.num / 2)};
+			output_avstream_video_codec_context->field_order = AV_FIELD_BB;
+			output_avstream_video_codec_context->flags |= AV_CODEC_FLAG_INTERLACED_DCT;
+		} else {
+			output_avstream_video_codec_context->time_base = (AVRational){output_field_rate.den, output_field_rate.num};
+		}
 
 		output_avstream_video->time_base = output_avstream_video_codec_context->time_base;
 		if ((output_avfmt->oformat->flags & AVFMT_GLOBALHEADER) != 0) {
 			output_avstream_video_codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 		}
 
-		if (avcodec_open2(output_avstream_video_codec_context, avcodec_find_encoder(AV_CODEC_ID_H264), nullptr) < 0) {
+		if (avcodec_open2(output_avstream_video_codec_context, codec, &codec_opts) < 0) {
 			fprintf(stderr, "Output stream cannot open codec\n");
+			av_dict_free(&codec_opts);
+			return 1;
+		}
+		for (AVDictionaryEntry* e = nullptr; (e = av_dict_get(codec_opts, "", e, AV_DICT_IGNORE_SUFFIX)) != nullptr;) {
+			fprintf(stderr, "%s has no option '%s'\n", codec->name, e->key);
+		}
+		av_dict_free(&codec_opts);
+
+		if (!output_avstream_video_encode_convert.init(
+				output_avstream_video_codec_context->pix_fmt, output_width, output_height)) {
+			fprintf(
+				stderr, "Cannot convert to %s\n", av_get_pix_fmt_name(output_avstream_video_codec_context->pix_fmt));
 			return 1;
 		}
+		fprintf(stderr, "Encoding %s, %s\n", codec->name,
+			av_get_pix_fmt_name(output_avstream_video_codec_context->pix_fmt));
 	}
 
 	if ((output_avfmt->oformat->flags & AVFMT_NOFILE) == 0) {
@@ -2094,6 +5226,11 @@ int main(int argc, char** argv) {
 		}
 	}
 
+	/* size the composite working planes once, not per field */
+	signal_scale.init();
+	if (!composite_render_context.arena.allocplanes(composite_width(), output_height)) { return 1; }
+	if (signal_scale.active) { fprintf(stderr, "Compositing at %d samples per scanline\n", composite_width()); }
+
 	/* prepare video encoding */
 	for (size_t i = 0; i <= output_avstream_video_frame_delay; i++) {
 		AVFrame* nf;
@@ -2103,7 +5240,7 @@ int main(int argc, char** argv) {
 			fprintf(stderr, "Failed to alloc video frame\n");
 			return 1;
 		}
-		nf->format = AV_PIX_FMT_BGRA;
+		nf->format = AV_PIX_FMT_YUV444P;
 		nf->height = output_height;
 		nf->width  = output_width;
 		if (av_frame_get_buffer(nf, 64) < 0) {
@@ -2111,60 +5248,47 @@ int main(int argc, char** argv) {
 			return 1;
 		}
 
-		// zero the frame ONCE.
+		// black the frame ONCE.
 		// what we want is, if a threshhold is given for the first input file,
 		// that it means the user wants us to cause a "hall of mirrors" effect where keying happens.
-		memset(nf->data[0], 0, nf->linesize[0] * nf->height);
+		memset(nf->data[0], 16, nf->linesize[0] * nf->height);
+		memset(nf->data[1], 128, nf->linesize[1] * nf->height);
+		memset(nf->data[2], 128, nf->linesize[2] * nf->height);
 
 		output_avstream_video_frame.push_back(nf);
 	}
 
-	{
-		output_avstream_video_encode_frame = av_frame_alloc();
-		if (output_avstream_video_encode_frame == nullptr) {
-			fprintf(stderr, "Failed to alloc video frame3\n");
-			return 1;
-		}
-		av_frame_set_colorspace(output_avstream_video_encode_frame, AVCOL_SPC_SMPTE170M);
-		av_frame_set_color_range(output_avstream_video_encode_frame, AVCOL_RANGE_MPEG);
-		output_avstream_video_encode_frame->format = output_avstream_video_codec_context->pix_fmt;
-		output_avstream_video_encode_frame->height = output_height;
-		output_avstream_video_encode_frame->width  = output_width;
-		if (av_frame_get_buffer(output_avstream_video_encode_frame, 64) < 0) {
-			fprintf(stderr, "Failed to alloc render frame2\n");
-			return 1;
-		}
+	/* frames in flight between the render pipeline stages */
+	if (!output_avstream_video_encode_buffers.init(AV_PIX_FMT_YUV444P, output_width, output_height)) {
+		fprintf(stderr, "Failed to alloc encode frame pool\n");
+		return 1;
+	}
+	for (int i = 0; i < (pipeline_depth + video_fields + (output_video_as_interlaced ? 3 : 2)); i++) {
+		AVFrame* nf;
 
-		memset(output_avstream_video_encode_frame->data[0], 16,
-			output_avstream_video_encode_frame->linesize[0] * output_avstream_video_encode_frame->height);
-		memset(output_avstream_video_encode_frame->data[1], 128,
-			output_avstream_video_encode_frame->linesize[1] * output_avstream_video_encode_frame->height);
-		memset(output_avstream_video_encode_frame->data[2], 128,
-			output_avstream_video_encode_frame->linesize[2] * output_avstream_video_encode_frame->height);
-	}
-
-	if (output_avstream_video_resampler == nullptr) {
-		output_avstream_video_resampler = sws_getContext(
-			// source
-			output_avstream_video_frame[0]->width, output_avstream_video_frame[0]->height,
-			static_cast<AVPixelFormat>(output_avstream_video_frame[0]->format),
-			// dest
-			output_avstream_video_encode_frame->width, output_avstream_video_encode_frame->height,
-			static_cast<AVPixelFormat>(output_avstream_video_encode_frame->format),
-			// opt
-			SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
-		if (output_avstream_video_resampler == nullptr) {
-			fprintf(stderr, "Failed to alloc ARGB -> codec converter\n");
+		nf = av_frame_alloc();
+		if (nf == nullptr) {
+			fprintf(stderr, "Failed to alloc video frame3\n");
 			return 1;
 		}
+		output_avstream_video_encode_pool.push_back(nf);
 	}
 
 	/* run all inputs and render to output, until done */
+	unsigned long long fields_rendered = 0;
+
+	render_pipeline = new RenderPipeline(pipeline_depth, video_measure_int16 ? 1 : video_fields);
+	render_pipeline->start();
 	{
 		bool			 eof;
 		bool			 copyaud;
-		signed long long upto	= 0;
-		signed long long current = 0;
+		bool			 audio_wanted = false;
+		signed long long upto		  = 0;
+		signed long long current	  = 0;
+
+		for (auto& input_file : input_files) {
+			if (input_file.input_avstream_audio != nullptr) { audio_wanted = true; }
+		}
 
 		do {
 			if (DIE != 0) { break; }
@@ -2202,7 +5326,7 @@ int main(int argc, char** argv) {
 
 							if (input_file.input_avstream_video_frame->pkt_pts == AV_NOPTS_VALUE ||
 								current >= input_file.input_avstream_video_frame->pkt_pts) {
-								input_file.frame_copy_scale();
+								input_file.queue_frame();
 								input_file.got_video = false;
 							}
 						} else {
@@ -2215,7 +5339,7 @@ int main(int argc, char** argv) {
 					}
 				} else {
 					if (input_file.got_video) {
-						input_file.frame_copy_scale();
+						input_file.queue_frame();
 						input_file.got_video = false;
 					}
 				}
@@ -2228,7 +5352,7 @@ int main(int argc, char** argv) {
 							if (input_file.got_video) {
 								if (input_file.input_avstream_video_frame->pkt_pts == AV_NOPTS_VALUE ||
 									current >= input_file.input_avstream_video_frame->pkt_pts) {
-									input_file.frame_copy_scale();
+									input_file.queue_frame();
 									input_file.got_video = false;
 								}
 							} else {
@@ -2240,121 +5364,49 @@ int main(int argc, char** argv) {
 						}
 					} else {
 						if (input_file.got_video) {
-							input_file.frame_copy_scale();
+							input_file.queue_frame();
 							input_file.got_video = false;
 						}
 					}
 
-					// composite the layer, keying against the color. all code assumes ARGB
-					composite_layer(output_avstream_video_frame[output_avstream_video_frame_index],
-						input_file.input_avstream_video_frame_rgb, input_file, (current & 1) ^ 1, current);
-				}
-
-				// field deinterlace
-				/*{
-					unsigned int field = (current & 1) ^ 1;
-					unsigned int sy;
-					unsigned int dy;
-					unsigned int y;
-
-					if (field != 0u) {
-						for (y = field; y < output_avstream_video_frame[output_avstream_video_frame_index]->height;
-							 y += 2) {
-							auto* d = reinterpret_cast<uint32_t*>(
-								output_avstream_video_frame[output_avstream_video_frame_index]->data[0] +
-								(output_avstream_video_frame[output_avstream_video_frame_index]->linesize[0] *
-									(y - 1)));
-							auto* s = reinterpret_cast<uint32_t*>(
-								output_avstream_video_frame[output_avstream_video_frame_index]->data[0] +
-								(output_avstream_video_frame[output_avstream_video_frame_index]->linesize[0] * y));
-
-							memcpy(d, s,
-								sizeof(uint32_t) *
-									output_avstream_video_frame[output_avstream_video_frame_index]->width);
-						}
-					} else {  // field == 0
-						for (y = 1; (y + 1) < output_avstream_video_frame[output_avstream_video_frame_index]->height;
-							 y += 2) {
-							auto* d = reinterpret_cast<uint32_t*>(
-								output_avstream_video_frame[output_avstream_video_frame_index]->data[0] +
-								(output_avstream_video_frame[output_avstream_video_frame_index]->linesize[0] * y));
-							auto* s = reinterpret_cast<uint32_t*>(
-								output_avstream_video_frame[output_avstream_video_frame_index]->data[0] +
-								(output_avstream_video_frame[output_avstream_video_frame_index]->linesize[0] *
-									(y + 1)));
-
-							memcpy(d, s,
-								sizeof(uint32_t) *
-									output_avstream_video_frame[output_avstream_video_frame_index]->width);
-						}
-					}
-				}*/
-
-				// convert ARGB to whatever the codec demands, and encode
-				output_avstream_video_encode_frame->pts =
-					output_avstream_video_frame[output_avstream_video_frame_index]->pts;
-				output_avstream_video_encode_frame->pkt_pts =
-					output_avstream_video_frame[output_avstream_video_frame_index]->pkt_pts;
-				output_avstream_video_encode_frame->pkt_dts =
-					output_avstream_video_frame[output_avstream_video_frame_index]->pkt_dts;
-				output_avstream_video_encode_frame->top_field_first =
-					output_avstream_video_frame[output_avstream_video_frame_index]->top_field_first;
-				output_avstream_video_encode_frame->interlaced_frame =
-					output_avstream_video_frame[output_avstream_video_frame_index]->interlaced_frame;
-
-				if (sws_scale(output_avstream_video_resampler,
-						// source
-						output_avstream_video_frame[output_avstream_video_frame_index]->data,
-						output_avstream_video_frame[output_avstream_video_frame_index]->linesize, 0,
-						output_avstream_video_frame[output_avstream_video_frame_index]->height,
-						// dest
-						output_avstream_video_encode_frame->data, output_avstream_video_encode_frame->linesize) <= 0) {
-					fprintf(stderr, "WARNING: sws_scale failed\n");
 				}
 
-				assert(output_avstream_video_frame_index < output_avstream_video_frame.size());
-				if ((++output_avstream_video_frame_index) >= output_avstream_video_frame_delay) {
-					output_avstream_video_frame_index = 0;
+				// outside the slice, only keep track of the latest frame of each input. the fields just before it are
+				// rendered but not encoded: the render targets carry them into the first fields of the slice
+				if (static_cast<unsigned long long>(current) >= segment_lead_field &&
+					static_cast<unsigned long long>(current) < segment_end_field) {
+					auto* job = new FieldJob;
+
+					job->field  = current;
+					job->encode = static_cast<unsigned long long>(current) >= segment_first_field;
+					for (auto& input_file : input_files) { job->decoded.push_back(input_file.take_queued_frame()); }
+					if (job->encode) { fields_rendered++; }
+					render_pipeline->submit(job);
 				}
-
-				EncoderChannel->push({output_avstream_video_encode_frame, current});
 				current++;
 			}
-		} while (!eof);
-		EncoderChannel->close();
-		EncoderThread.join();
-	}
-
-	/* flush encoder delay */
-	do {
-		AVPacket pkt;
-		int		 gotit = 0;
-
-		av_init_packet(&pkt);
-		if (av_new_packet(&pkt, 50000000 / 8) < 0) { break; }
-
-		if (avcodec_encode_video2(output_avstream_video_codec_context, &pkt, nullptr, &gotit) == 0) {
-			if (gotit != 0) {
-				pkt.stream_index = output_avstream_video->index;
-				av_packet_rescale_ts(
-					&pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
 
-				if (av_interleaved_write_frame(output_avfmt, &pkt) < 0) {
-					fprintf(stderr, "AV write frame failed video\n");
-				}
+			if (static_cast<unsigned long long>(current) >= segment_end_field &&
+				(!audio_wanted || audio_written_to >= segment_end_sample)) {
+				break;
 			}
-		}
-
-		av_packet_unref(&pkt);
-		if (gotit == 0) { break; }
-	} while (1);
+		} while (!eof);
+		render_pipeline->finish();
+	}
+	delete render_pipeline;
+	render_pipeline = nullptr;
 
 	/* close output */
-	if (output_avstream_video_resampler != nullptr) {
-		sws_freeContext(output_avstream_video_resampler);
-		output_avstream_video_resampler = nullptr;
+	for (auto* nf : output_avstream_video_encode_pool) { av_frame_free(&nf); }
+	output_avstream_video_encode_pool.clear();
+	output_avstream_video_encode_buffers.uninit();
+	output_avstream_video_encode_convert.uninit();
+	composite_render_context.arena.freeplanes();
+	if (video_measure_int16) { work_format_probe.report(); }
+	if (source_cache_lookups > 0) {
+		fprintf(stderr, "Source cache: %llu of %llu fields reused (%.1f%%)\n", source_cache_hits.load(),
+			source_cache_lookups.load(), (source_cache_hits * 100.0) / source_cache_lookups);
 	}
-	if (output_avstream_video_encode_frame != nullptr) { av_frame_free(&output_avstream_video_encode_frame); }
 	while (!output_avstream_video_frame.empty()) {
 		AVFrame* nf = output_avstream_video_frame.back();
 		output_avstream_video_frame.pop_back();
@@ -2366,6 +5418,7 @@ int main(int argc, char** argv) {
 		avio_closep(&output_avfmt->pb);
 	}
 	avformat_free_context(output_avfmt);
+	if (segment_rendering() || !segment_manifest.empty()) { write_segment_manifest(fields_rendered); }
 
 	/* close all */
 	for (auto& input_file : input_files) { input_file.close_input(); }
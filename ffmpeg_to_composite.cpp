@@ -1139,29 +1139,40 @@ void render_field(
 	}
 }
 
-void output_frame(AVFrame* frame, unsigned long long field_number, unsigned int field) {
-	int		 gotit = 0;
-	AVPacket pkt;
+// send a frame to the video encoder (NULL at the end, to drain it) and write out the packets it has ready.
+// one packet does for all of them: av_interleaved_write_frame() takes what it holds and leaves it blank
+void encode_video(AVFrame* frame) {
+	static AVPacket* pkt = NULL;
 
-	av_init_packet(&pkt);
-	if (av_new_packet(&pkt, 50000000 / 8) < 0) {
+	if (pkt == NULL && (pkt = av_packet_alloc()) == NULL) {
 		fprintf(stderr, "Failed to alloc vid packet\n");
 		return;
 	}
 
+	if (avcodec_send_frame(output_avstream_video_codec_context, frame) >= 0) {
+		while (avcodec_receive_packet(output_avstream_video_codec_context, pkt) >= 0) {
+			pkt->stream_index = output_avstream_video->index;
+			av_packet_rescale_ts(pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
+
+			if (av_interleaved_write_frame(output_avfmt, pkt) < 0) fprintf(stderr, "AV write frame failed video\n");
+		}
+	} else {
+		fprintf(stderr, "Failed to encode video\n");
+	}
+
+	if (frame == NULL) av_packet_free(&pkt);
+}
+
+void output_frame(AVFrame* frame, unsigned long long field_number, unsigned int field) {
 	frame->key_frame = (field_number % (15ULL * 2ULL)) == 0 ? 1 : 0;
 
 	if (output_video_as_interlaced) {
 		frame->interlaced_frame = 1;
 		frame->top_field_first  = (field == 0) ? 1 : 0;
 		frame->pts				= field_number / 2ULL;
-		pkt.pts					= field_number / 2ULL;
-		pkt.dts					= field_number / 2ULL;
 	} else {
 		frame->interlaced_frame = 0;
 		frame->pts				= field_number;
-		pkt.pts					= field_number;
-		pkt.dts					= field_number;
 	}
 
 	fprintf(stderr,
@@ -1170,16 +1181,7 @@ void output_frame(AVFrame* frame, unsigned long long field_number, unsigned int
 		field_number);
 	fflush(stderr);
 	if (output_video_as_interlaced && use_422_colorspace) {  // 4:2:2 interlaced = use as-is
-		if (avcodec_encode_video2(output_avstream_video_codec_context, &pkt, frame, &gotit) == 0) {
-			if (gotit) {
-				pkt.stream_index = output_avstream_video->index;
-				av_packet_rescale_ts(
-					&pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
-
-				if (av_interleaved_write_frame(output_avfmt, &pkt) < 0)
-					fprintf(stderr, "AV write frame failed video\n");
-			}
-		}
+		encode_video(frame);
 	} else {
 		output_avstream_video_bob_frame->interlaced_frame = frame->interlaced_frame;
 		output_avstream_video_bob_frame->top_field_first  = frame->top_field_first;
@@ -1248,20 +1250,8 @@ void output_frame(AVFrame* frame, unsigned long long field_number, unsigned int
 			}
 		}
 
-		if (avcodec_encode_video2(output_avstream_video_codec_context, &pkt, output_avstream_video_bob_frame, &gotit) ==
-			0) {
-			if (gotit) {
-				pkt.stream_index = output_avstream_video->index;
-				av_packet_rescale_ts(
-					&pkt, output_avstream_video_codec_context->time_base, output_avstream_video->time_base);
-
-				if (av_interleaved_write_frame(output_avfmt, &pkt) < 0)
-					fprintf(stderr, "AV write frame failed video\n");
-			}
-		}
+		encode_video(output_avstream_video_bob_frame);
 	}
-
-	av_packet_unref(&pkt);
 }
 
 void preset_PAL() {
@@ -1608,11 +1598,15 @@ int		  audio_dst_data_alloc_samples = 0;
 int		  audio_dst_data_linesize	  = 0;
 int		  audio_dst_data_samples	   = 0;
 
-bool do_video_decode_and_render(AVPacket& pkt, unsigned long long& video_field) {
-	int got_frame = 0;
+// send a packet to the video decoder (NULL at the end, to drain it) and render every frame it has ready
+void do_video_decode_and_render(AVPacket* pkt, unsigned long long& video_field) {
+	if (avcodec_send_packet(input_avstream_video_codec_context, pkt) < 0) {
+		fprintf(stderr, "No video decoded\n");
+		return;
+	}
 
-	if (avcodec_decode_video2(input_avstream_video_codec_context, input_avstream_video_frame, &got_frame, &pkt) >= 0) {
-		if (got_frame != 0 && input_avstream_video_frame->width > 0 && input_avstream_video_frame->height > 0) {
+	while (avcodec_receive_frame(input_avstream_video_codec_context, input_avstream_video_frame) >= 0) {
+		if (input_avstream_video_frame->width > 0 && input_avstream_video_frame->height > 0) {
 			unsigned long long tgt_field = input_avstream_video_frame->pkt_pts;
 
 			if (tgt_field == AV_NOPTS_VALUE) tgt_field = input_avstream_video_frame->pkt_dts;
@@ -1654,7 +1648,7 @@ bool do_video_decode_and_render(AVPacket& pkt, unsigned long long& video_field)
 				output_avstream_video_input_frame = av_frame_alloc();
 				if (output_avstream_video_input_frame == NULL) {
 					fprintf(stderr, "Failed to alloc video frame\n");
-					return 1;
+					return;
 				}
 				av_frame_set_colorspace(output_avstream_video_input_frame, AVCOL_SPC_SMPTE170M);
 				av_frame_set_color_range(output_avstream_video_input_frame, AVCOL_RANGE_MPEG);
@@ -1673,7 +1667,7 @@ bool do_video_decode_and_render(AVPacket& pkt, unsigned long long& video_field)
 				output_avstream_video_input_frame->width  = output_width;
 				if (av_frame_get_buffer(output_avstream_video_input_frame, 64) < 0) {
 					fprintf(stderr, "Failed to alloc render frame\n");
-					return 1;
+					return;
 				}
 			}
 
@@ -1748,20 +1742,20 @@ bool do_video_decode_and_render(AVPacket& pkt, unsigned long long& video_field)
 				}
 			}
 		}
-	} else {
-		fprintf(stderr, "No video decoded\n");
 	}
-
-	return (got_frame != 0);
 }
 
-bool do_audio_decode_and_render(AVPacket& pkt, unsigned long long& audio_sample) {
-	int got_frame = 0;
+// send a packet to the audio decoder (NULL at the end, to drain it) and render every frame it has ready
+void do_audio_decode_and_render(AVPacket* pkt, unsigned long long& audio_sample) {
+	if (avcodec_send_packet(input_avstream_audio_codec_context, pkt) < 0) {
+		fprintf(stderr, "No audio decoded\n");
+		return;
+	}
 
-	if (avcodec_decode_audio4(input_avstream_audio_codec_context, input_avstream_audio_frame, &got_frame, &pkt) >= 0) {
-		if (got_frame != 0 && input_avstream_audio_frame->nb_samples != 0) {
+	while (avcodec_receive_frame(input_avstream_audio_codec_context, input_avstream_audio_frame) >= 0) {
+		if (input_avstream_audio_frame->nb_samples != 0) {
 			unsigned long long tgt_sample = input_avstream_audio_frame->pts;
-			if (tgt_sample == AV_NOPTS_VALUE) tgt_sample = pkt.pts;
+			if (tgt_sample == AV_NOPTS_VALUE) tgt_sample = input_avstream_audio_frame->pkt_pts;
 
 			if (tgt_sample == AV_NOPTS_VALUE)
 				tgt_sample = audio_sample;  // don't want me to guess? give me PTS timestamps then!
@@ -1803,7 +1797,7 @@ bool do_audio_decode_and_render(AVPacket& pkt, unsigned long long& audio_sample)
 				if (swr_init(input_avstream_audio_resampler) < 0) {
 					fprintf(stderr, "Failed to init audio resampler\n");
 					swr_free(&input_avstream_audio_resampler);
-					return got_frame;
+					continue;
 				}
 				input_avstream_audio_resampler_rate		= input_avstream_audio_codec_context->sample_rate;
 				input_avstream_audio_resampler_channels = input_avstream_audio_codec_context->channels;
@@ -1900,11 +1894,7 @@ bool do_audio_decode_and_render(AVPacket& pkt, unsigned long long& audio_sample)
 				}
 			}
 		}
-	} else {
-		fprintf(stderr, "No audio decoded\n");
 	}
-
-	return (got_frame != 0);
 }
 
 int main(int argc, char** argv) {
@@ -1954,6 +1944,7 @@ int main(int argc, char** argv) {
 				ac++;
 			} else if (isctx->codec_type == AVMEDIA_TYPE_VIDEO) {
 				if (input_avstream_video == NULL && vc == video_stream_index) {
+					isctx->thread_count = 0;  // one decoder thread per CPU
 					if (avcodec_open2(isctx, avcodec_find_decoder(isctx->codec_id), NULL) >= 0) {
 						input_avstream_video			   = is;
 						input_avstream_video_codec_context = isctx;
@@ -2189,7 +2180,6 @@ int main(int argc, char** argv) {
 		unsigned long long audio_sample		= 0;
 		unsigned long long video_field		= 0;
 		double			   adj_time			= 0;
-		int				   got_frame		= 0;
 		double			   t, pt = -1;
 		AVPacket		   pkt;
 
@@ -2244,7 +2234,7 @@ int main(int argc, char** argv) {
 
 			if (input_avstream_audio != NULL && pkt.stream_index == input_avstream_audio->index) {
 				av_packet_rescale_ts(&pkt, input_avstream_audio->time_base, output_avstream_audio->time_base);
-				do_audio_decode_and_render(/*&*/ pkt, /*&*/ audio_sample);
+				do_audio_decode_and_render(&pkt, /*&*/ audio_sample);
 			} else if (input_avstream_video != NULL && pkt.stream_index == input_avstream_video->index) {
 				AVRational m = (AVRational){output_field_rate.den, output_field_rate.num};
 				av_packet_rescale_ts(&pkt, input_avstream_video->time_base, m);  // convert to FIELD number
@@ -2256,7 +2246,7 @@ int main(int argc, char** argv) {
 				}
 
 				av_frame_counter++;
-				do_video_decode_and_render(/*&*/ pkt, /*&*/ video_field);
+				do_video_decode_and_render(&pkt, /*&*/ video_field);
 			}
 
 			av_packet_unref(&pkt);
@@ -2266,21 +2256,16 @@ int main(int argc, char** argv) {
 		av_packet_unref(&pkt);
 		av_init_packet(&pkt);
 
-		/* the encoder usually has a delay.
-		 * we need the encoder to flush those frames out. */
-		{
-			do {
-				if (DIE != 0) break;
-
-				pkt.size = 0;
-				pkt.data = NULL;
-				if (input_avstream_video != NULL)
-					got_frame = do_video_decode_and_render(/*&*/ pkt, /*&*/ video_field) ? 1 : 0;
-				if (input_avstream_audio != NULL)
-					got_frame |= do_audio_decode_and_render(/*&*/ pkt, /*&*/ audio_sample) ? 1 : 0;
-			} while (got_frame);
+		/* the decoders usually have a delay.
+		 * we need the decoders to flush those frames out. */
+		if (DIE == 0) {
+			if (input_avstream_video != NULL) do_video_decode_and_render(NULL, /*&*/ video_field);
+			if (input_avstream_audio != NULL) do_audio_decode_and_render(NULL, /*&*/ audio_sample);
 		}
 
+		/* the encoder has a delay too */
+		encode_video(NULL);
+
 		if (audio_dst_data != NULL) {
 			av_freep(&audio_dst_data[0]);  // NTS: Why??
 			av_freep(&audio_dst_data);